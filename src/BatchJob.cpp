@@ -0,0 +1,41 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "BatchJob.h"
+#include "Project.h"
+
+BatchJob::BatchJob(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Project> &project,
+                   const List<std::shared_ptr<QueryJob> > &jobs)
+    : QueryJob(query, project), mJobs(jobs)
+{
+}
+
+int BatchJob::execute()
+{
+    const Flags<WriteFlag> flags = Unfiltered|IgnoreMax|DontQuote;
+    for (int i=0; i<mJobs.size(); ++i) {
+        if (isAborted())
+            return 1;
+        int ret = 1;
+        if (const std::shared_ptr<QueryJob> &job = mJobs.at(i)) {
+            ret = job->runNested(this);
+        } else {
+            write("Not indexed", flags);
+        }
+        if (!write<32>(flags, "%c%d %d", BatchDelimiter, i, ret))
+            return 1;
+    }
+    return 0;
+}
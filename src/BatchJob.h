@@ -0,0 +1,39 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef BatchJob_h
+#define BatchJob_h
+
+#include <rct/List.h>
+#include "QueryJob.h"
+
+// Runs the jobs of a QueryMessage::Batch one after another in a single
+// scope. Each job's output is followed by a line with BatchDelimiter, the
+// sub query's index and its return code. Null jobs couldn't be resolved and
+// are answered with "Not indexed".
+class BatchJob : public QueryJob
+{
+public:
+    static const char BatchDelimiter = '\x1e';
+
+    BatchJob(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Project> &project,
+             const List<std::shared_ptr<QueryJob> > &jobs);
+protected:
+    virtual int execute() override;
+private:
+    const List<std::shared_ptr<QueryJob> > mJobs;
+};
+
+#endif
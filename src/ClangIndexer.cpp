@@ -13,7 +13,6 @@
    You should have received a copy of the GNU General Public License
    along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 
-#define RTAGS_SINGLE_THREAD
 #include <rct/SHA256.h>
 #include "ClangIndexer.h"
 #include "Diagnostic.h"
@@ -27,6 +26,9 @@
 #include "Diagnostic.h"
 #include "RClient.h"
 #include <unistd.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <functional>
 #if CINDEX_VERSION >= CINDEX_VERSION_ENCODE(0, 25)
 #include <clang-c/Documentation.h>
 #endif
@@ -53,12 +55,12 @@ static inline void setType(Symbol &symbol, const CXType &type)
 }
 
 Flags<Server::Option> ClangIndexer::sServerOpts;
-ClangIndexer::ClangIndexer()
-    : mClangUnit(0), mIndex(0), mLastCursor(nullCursor), mVisitFileResponseMessageFileId(0),
+ClangIndexer::ClangIndexer(CXIndex index)
+    : mClangUnit(0), mIndex(index), mOwnsIndex(false), mLastCursor(nullCursor), mVisitFileResponseMessageFileId(0),
       mVisitFileResponseMessageVisit(0), mParseDuration(0), mVisitDuration(0),
       mBlocked(0), mAllowed(0), mIndexed(1), mVisitFileTimeout(0),
       mIndexDataMessageTimeout(0), mFileIdsQueried(0), mLogFile(0),
-      mConnection(Connection::create(RClient::NumOptions))
+      mConnection(Connection::create(RClient::NumOptions)), mComparing(false)
 {
     mConnection->newMessage().connect(std::bind(&ClangIndexer::onMessage, this,
                                                 std::placeholders::_1, std::placeholders::_2));
@@ -70,7 +72,7 @@ ClangIndexer::~ClangIndexer()
         fclose(mLogFile);
     if (mClangUnit)
         clang_disposeTranslationUnit(mClangUnit);
-    if (mIndex)
+    if (mOwnsIndex)
         clang_disposeIndex(mIndex);
 }
 
@@ -90,8 +92,13 @@ bool ClangIndexer::exec(const String &data)
     int32_t niceValue;
     Hash<uint32_t, Path> blockedFiles;
     String dataDir;
+    Path indexCacheDir;
+    uint64_t indexCacheSize;
 
     deserializer >> id;
+    // tell rdm which job of the batch we're on, a crash from here on is this one's
+    printf("@JOB@%llu@JOB@", static_cast<unsigned long long>(id));
+    fflush(stdout);
     deserializer >> socketFile;
     deserializer >> mProject;
     deserializer >> mSource;
@@ -105,6 +112,7 @@ bool ClangIndexer::exec(const String &data)
     deserializer >> sServerOpts;
     deserializer >> mUnsavedFiles;
     deserializer >> dataDir;
+    deserializer >> indexCacheDir >> indexCacheSize;
     deserializer >> blockedFiles;
 
 #if 0
@@ -164,17 +172,34 @@ bool ClangIndexer::exec(const String &data)
 
     assert(mConnection->isConnected());
     mIndexDataMessage.files()[mSource.fileId] |= IndexDataMessage::Visited;
-    parse() && visit() && diagnose();
+
+    // unsaved files aren't on disk so we can't tell whether the cache matches them
+    std::unique_ptr<IndexCache> cache;
+    uint64_t manifestKey = 0;
+    bool cached = false;
+    if (!indexCacheDir.isEmpty() && mUnsavedFiles.isEmpty()) {
+        cache.reset(new IndexCache(indexCacheDir, indexCacheSize, mProject));
+        manifestKey = cache->manifestKey(mSource, mSourceFile);
+        cached = loadFromCache(*cache, manifestKey);
+    }
+    if (!cached && parse() && visit() && diagnose()) {
+        hashFiles(parseTime);
+        findLeadingIncludes();
+    }
     String message = mSourceFile.toTilde();
     String err;
     StopWatch sw;
     int writeDuration = -1;
-    if (!mClangUnit || !writeFiles(RTags::encodeSourceFilePath(dataDir, mProject, 0), err)) {
+    Hash<uint32_t, Hash<String, String> > written;
+    if ((!mClangUnit && !cached)
+        || !writeFiles(RTags::encodeSourceFilePath(dataDir, mProject, 0), err, cache && !cached ? &written : 0)) {
         message += " error";
         if (!err.isEmpty())
             message += (' ' + err);
     } else {
         writeDuration = sw.elapsed();
+        if (cache && !cached && !(mIndexDataMessage.flags() & IndexDataMessage::ParseFailure))
+            storeInCache(*cache, manifestKey, parseTime, written);
     }
     message += String::format<16>(" in %lldms. ", mTimer.elapsed());
     int cursorCount = 0;
@@ -190,12 +215,29 @@ bool ClangIndexer::exec(const String &data)
                                        mIndexDataMessage.files().size(), mAllowed,
                                        mAllowed + mBlocked, mFileIdsQueried,
                                        mParseDuration, mVisitDuration, writeDuration);
+    } else if (cached) {
+        message += String::format<64>("(%d of %d files from index cache)", static_cast<int>(mCachedMaps.size()),
+                                      static_cast<int>(mIndexDataMessage.files().size()));
     }
     if (mIndexDataMessage.indexerJobFlags() & IndexerJob::Dirty)
         message += " (dirty)";
     ++mFileIdsQueried;
 
     mIndexDataMessage.setMessage(message);
+    {
+        IndexCost cost;
+        cost.duration = mTimer.elapsed();
+        cost.headerCount = mIndexDataMessage.files().size() - 1;
+        struct rusage usage;
+        if (!getrusage(RUSAGE_SELF, &usage)) {
+#ifdef OS_Darwin
+            cost.peakMemory = usage.ru_maxrss;
+#else
+            cost.peakMemory = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+        }
+        mIndexDataMessage.setCost(cost);
+    }
     sw.restart();
     if (!mConnection->send(mIndexDataMessage)) {
         error() << "Couldn't send IndexDataMessage" << mSourceFile;
@@ -271,6 +313,13 @@ Location ClangIndexer::createLocation(const Path &sourceFile, unsigned int line,
         return Location(id, line, col);
     }
 
+    if (mComparing) {
+        // files are only handed out to the real run
+        if (blockedPtr)
+            *blockedPtr = true;
+        return Location();
+    }
+
     ++mFileIdsQueried;
     VisitFileMessage msg(resolved, mProject, mIndexDataMessage.key());
 
@@ -978,6 +1027,8 @@ void ClangIndexer::handleInclude(const CXCursor &cursor, CXCursorKind kind, cons
             unit(location)->symbolNames[(include + path)].insert(location);
             unit(location)->symbolNames[(include + path.fileName())].insert(location);
             mIndexDataMessage.includes().push_back(std::make_pair(location.fileId(), refLoc.fileId()));
+            if (location.fileId() == mSource.fileId)
+                mSourceFileIncludes[location.line()] = refLoc.fileId();
             c.symbolName = "#include " + RTags::eatString(clang_getCursorDisplayName(cursor));
             c.kind = cursor.kind;
             c.symbolLength = c.symbolName.size() + 2;
@@ -1216,8 +1267,10 @@ bool ClangIndexer::parse()
 {
     StopWatch sw;
     assert(!mClangUnit);
-    assert(!mIndex);
-    mIndex = clang_createIndex(0, 1);
+    if (!mIndex) {
+        mIndex = clang_createIndex(0, 1);
+        mOwnsIndex = true;
+    }
     assert(mIndex);
     const Flags<Source::CommandLineFlag> commandLineFlags = Source::Default;
     const Flags<CXTranslationUnit_Flags> flags = CXTranslationUnit_DetailedPreprocessingRecord;
@@ -1240,6 +1293,29 @@ bool ClangIndexer::parse()
     RTags::parseTranslationUnit(mSourceFile, mSource.toCommandLine(commandLineFlags), mClangUnit,
                                 mIndex, &unsavedFiles[0], unsavedIndex, flags, &mClangLine);
 
+    const int pch = mSource.arguments.indexOf("-include-pch");
+    if (pch != -1) {
+        // rdm drops a pch when a file in it is modified but we might still
+        // have been started with it, clang refuses to use it then
+        bool fatal = !mClangUnit;
+        for (unsigned int i=0; !fatal && i<clang_getNumDiagnostics(mClangUnit); ++i) {
+            CXDiagnostic diagnostic = clang_getDiagnostic(mClangUnit, i);
+            fatal = clang_getDiagnosticSeverity(diagnostic) == CXDiagnostic_Fatal;
+            clang_disposeDiagnostic(diagnostic);
+        }
+        if (fatal) {
+            warning() << "Failed to use pch" << mSource.arguments.value(pch + 1) << "for" << mSourceFile;
+            if (mClangUnit) {
+                clang_disposeTranslationUnit(mClangUnit);
+                mClangUnit = 0;
+            }
+            mSource.arguments.removeAt(pch);
+            mSource.arguments.removeAt(pch);
+            RTags::parseTranslationUnit(mSourceFile, mSource.toCommandLine(commandLineFlags), mClangUnit,
+                                        mIndex, &unsavedFiles[0], unsavedIndex, flags, &mClangLine);
+        }
+    }
+
     warning() << "CI::parse loading unit:" << mClangLine << " " << (mClangUnit != 0);
     if (mClangUnit) {
         mParseDuration = sw.elapsed();
@@ -1261,7 +1337,19 @@ static inline Map<String, Set<Location> > convertTargets(const Map<Location, Map
     return ret;
 }
 
-bool ClangIndexer::writeFiles(const Path &root, String &error)
+template <typename Key, typename Value>
+static inline bool writeFileMap(const String &path, const String &name, const Map<Key, Value> &map,
+                                Hash<uint32_t, Hash<String, String> > *written, uint32_t fileId)
+{
+    const String data = FileMap<Key, Value>::encode(map);
+    if (!FileMap<Key, Value>::writeData(path + name, data))
+        return false;
+    if (written)
+        (*written)[fileId][name] = data;
+    return true;
+}
+
+bool ClangIndexer::writeFiles(const Path &root, String &error, Hash<uint32_t, Hash<String, String> > *written)
 {
     for (const auto &unit : mUnits) {
         if (!(mIndexDataMessage.files().value(unit.first) & IndexDataMessage::Visited)) {
@@ -1282,23 +1370,35 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
         //           << unit.second->targets.size()
         //           << unit.second->usrs.size()
         //           << unit.second->symbolNames.size();
-        if (!FileMap<Location, Symbol>::write(unitRoot + "/symbols", unit.second->symbols)) {
+        if (!writeFileMap(unitRoot, "/symbols", unit.second->symbols, written, unit.first)) {
             error = "Failed to write symbols";
             return false;
         }
-        if (!FileMap<String, Set<Location> >::write(unitRoot + "/targets", convertTargets(unit.second->targets))) {
+        if (!writeFileMap(unitRoot, "/targets", convertTargets(unit.second->targets), written, unit.first)) {
             error = "Failed to write targets";
             return false;
         }
-        if (!FileMap<String, Set<Location> >::write(unitRoot + "/usrs", unit.second->usrs)) {
+        if (!writeFileMap(unitRoot, "/usrs", unit.second->usrs, written, unit.first)) {
             error = "Failed to write usrs";
             return false;
         }
-        if (!FileMap<String, Set<Location> >::write(unitRoot + "/symnames", unit.second->symbolNames)) {
+        if (!writeFileMap(unitRoot, "/symnames", unit.second->symbolNames, written, unit.first)) {
             error = "Failed to write symbolNames";
             return false;
         }
     }
+    for (const auto &maps : mCachedMaps) {
+        String unitRoot = root;
+        unitRoot << maps.first;
+        Path::mkdir(unitRoot, Path::Recursive);
+        for (const auto &map : maps.second) {
+            // the encoding doesn't depend on the types
+            if (!FileMap<String, Set<Location> >::writeData(unitRoot + map.first, map.second)) {
+                error = "Failed to write cached " + map.first.mid(1);
+                return false;
+            }
+        }
+    }
     String sourceRoot = root;
     sourceRoot << mSource.fileId;
     Path::mkdir(sourceRoot, Path::Recursive);
@@ -1506,6 +1606,196 @@ bool ClangIndexer::diagnose()
     return true;
 }
 
+void ClangIndexer::hashFiles(uint64_t parseTime)
+{
+    for (const auto &it : mIndexDataMessage.files()) {
+        if (!(it.second & IndexDataMessage::Visited))
+            continue;
+        const Path path = Location::path(it.first);
+        if (mUnsavedFiles.contains(path))
+            continue;
+        const String contents = path.readAll();
+        // if the file changed after we started parsing we can't know
+        // whether the hash matches what we indexed
+        const uint64_t lastModified = path.lastModifiedMs();
+        if (lastModified && lastModified <= parseTime) {
+            RTags::FileHash &hash = mIndexDataMessage.fileHashes()[it.first];
+            hash.hash = RTags::contentHash(contents);
+            hash.lastModified = lastModified;
+            hash.recorded = parseTime;
+        }
+    }
+}
+
+bool ClangIndexer::loadFromCache(const IndexCache &cache, uint64_t manifestKey)
+{
+    IndexCache::Result result;
+    if (!cache.find(manifestKey, result))
+        return false;
+
+    // The cached data uses the file ids of the rdm that wrote it, possibly
+    // for a checkout somewhere else. This asks rdm for the files like a
+    // parse would, if we end up parsing anyway the answers are reused.
+    Hash<uint32_t, uint32_t> fileIds;
+    bool remap = false;
+    for (const auto &file : result.files) {
+        uint32_t fileId = mSource.fileId;
+        if (file.second != mSourceFile) {
+            bool blocked;
+            createLocation(file.second, 1, 1, &blocked);
+            fileId = Location::fileId(file.second);
+            if (!fileId) {
+                warning() << "Index cache entry for" << mSourceFile << "has a file rdm doesn't know" << file.second;
+                return false;
+            }
+        }
+        fileIds[file.first] = fileId;
+        remap = remap || fileId != file.first;
+    }
+    if (remap)
+        IndexCache::remap(result, fileIds);
+
+    // we have data for the files the cached run visited, if we now get to
+    // visit others we have to parse
+    const IndexDataMessage &cached = result.message;
+    const Set<uint32_t> visited = mIndexDataMessage.visitedFiles();
+    Set<uint32_t> dropped = cached.visitedFiles();
+    for (uint32_t fileId : visited) {
+        if (!dropped.remove(fileId))
+            return false;
+    }
+
+    for (auto &file : mIndexDataMessage.files())
+        file.second |= (cached.files().value(file.first) & IndexDataMessage::HeaderError);
+    mIndexDataMessage.includes() = cached.includes();
+    for (const auto &fixIts : cached.fixIts()) {
+        if (!dropped.contains(fixIts.first))
+            mIndexDataMessage.fixIts()[fixIts.first] = fixIts.second;
+    }
+    for (const auto &diagnostic : cached.diagnostics()) {
+        if (!dropped.contains(diagnostic.first.fileId()))
+            mIndexDataMessage.diagnostics()[diagnostic.first] = diagnostic.second;
+    }
+    for (const auto &declaration : cached.declarations()) {
+        Set<uint32_t> files = declaration.second;
+        for (uint32_t fileId : dropped)
+            files.remove(fileId);
+        if (!files.isEmpty())
+            mIndexDataMessage.declarations()[declaration.first] = files;
+    }
+    for (const auto &hash : cached.fileHashes()) {
+        if (!visited.contains(hash.first))
+            continue;
+        // the contents match the cache entry, the times are this parse's
+        const uint64_t lastModified = Location::path(hash.first).lastModifiedMs();
+        if (lastModified && lastModified <= mIndexDataMessage.parseTime()) {
+            RTags::FileHash &fileHash = mIndexDataMessage.fileHashes()[hash.first];
+            fileHash.hash = hash.second.hash;
+            fileHash.lastModified = lastModified;
+            fileHash.recorded = mIndexDataMessage.parseTime();
+        }
+    }
+    mIndexDataMessage.setFlags(cached.flags());
+    mIndexDataMessage.leadingIncludes() = cached.leadingIncludes();
+    for (uint32_t fileId : visited) {
+        const auto maps = result.maps.value(fileId);
+        if (!maps.isEmpty())
+            mCachedMaps[fileId] = maps;
+    }
+    return true;
+}
+
+static void inclusionVisitor(CXFile includedFile, CXSourceLocation *, unsigned, CXClientData userData)
+{
+    Set<Path> &files = *reinterpret_cast<Set<Path> *>(userData);
+    const Path path = Path::resolved(RTags::eatString(clang_getFileName(includedFile)));
+    if (!path.isEmpty())
+        files.insert(path);
+}
+
+void ClangIndexer::storeInCache(IndexCache &cache, uint64_t manifestKey, uint64_t parseTime,
+                                const Hash<uint32_t, Hash<String, String> > &maps)
+{
+    // The entry depends on every file the translation unit included, not
+    // just the ones we got locations in. Headers only reached through
+    // blocked headers or without any cursors change the result too.
+    Set<Path> included;
+    assert(mClangUnit);
+    clang_getInclusions(mClangUnit, inclusionVisitor, &included);
+    Hash<uint32_t, Path> files;
+    for (const auto &it : mIndexDataMessage.files()) {
+        const Path path = Location::path(it.first);
+        files[it.first] = path;
+        included.insert(path);
+    }
+
+    IndexCache::Dependencies dependencies;
+    for (const Path &path : included) {
+        const uint64_t lastModified = path.lastModifiedMs();
+        if (!lastModified || lastModified > parseTime)
+            return;
+        dependencies.append(std::make_pair(path, RTags::contentHash(path.readAll())));
+    }
+    std::sort(dependencies.begin(), dependencies.end());
+    cache.insert(manifestKey, dependencies, mIndexDataMessage, files, maps);
+}
+
+void ClangIndexer::findLeadingIncludes()
+{
+    // Only the #include lines before anything else in the source file can be
+    // replaced by a pch. Comments and blank lines are fine, anything else
+    // (#define, #if, code) ends it.
+    const String contents = mUnsavedFiles.value(mSourceFile, mSourceFile.readAll());
+    List<uint32_t> &leading = mIndexDataMessage.leadingIncludes();
+    static const char commentEnd[] = "*/";
+    bool inComment = false;
+    unsigned int line = 0;
+    const char *ch = contents.constData();
+    const char *end = ch + contents.size();
+    while (ch < end) {
+        ++line;
+        const char *eol = static_cast<const char *>(memchr(ch, '\n', end - ch));
+        if (!eol)
+            eol = end;
+        const char *p = ch;
+        ch = eol + 1;
+        if (inComment) {
+            p = std::search(p, eol, commentEnd, commentEnd + 2);
+            if (p == eol)
+                continue;
+            inComment = false;
+            p += 2;
+        }
+        while (p < eol && isspace(static_cast<unsigned char>(*p)))
+            ++p;
+        if (p == eol || (eol - p >= 2 && !strncmp(p, "//", 2)))
+            continue;
+        if (eol - p >= 2 && !strncmp(p, "/*", 2)) {
+            const char *close = std::search(p + 2, eol, commentEnd, commentEnd + 2);
+            if (close == eol) {
+                inComment = true;
+                continue;
+            }
+            p = close + 2;
+            while (p < eol && isspace(static_cast<unsigned char>(*p)))
+                ++p;
+            if (p == eol)
+                continue;
+        }
+        if (*p != '#')
+            break;
+        ++p;
+        while (p < eol && isspace(static_cast<unsigned char>(*p)))
+            ++p;
+        if (eol - p < 7 || strncmp(p, "include", 7))
+            break;
+        const uint32_t fileId = mSourceFileIncludes.value(line);
+        if (!fileId)
+            break;
+        leading.append(fileId);
+    }
+}
+
 bool ClangIndexer::visit()
 {
     if (!mClangUnit || !mSource.fileId) {
@@ -1514,15 +1804,25 @@ bool ClangIndexer::visit()
 
     StopWatch watch;
 
-    clang_visitChildren(clang_getTranslationUnitCursor(mClangUnit),
-                        ClangIndexer::indexVisitor, this);
+    if (sServerOpts & Server::IndexerCallbacks) {
+        if (!indexEntities())
+            error() << "clang_indexTranslationUnit failed for" << mSourceFile;
+    } else {
+        visitCursors();
+    }
+
+    if (getenv("RTAGS_COMPARE_INDEXERS")) {
+        mVisitDuration = watch.elapsed();
+        compareEngines();
+        watch.restart();
+    }
 
     for (const auto &it : mIndexDataMessage.files()) {
         if (it.second & IndexDataMessage::Visited)
             addFileSymbol(it.first);
     }
 
-    mVisitDuration = watch.elapsed();
+    mVisitDuration += watch.elapsed();
 
     if (testLog(LogLevel::VerboseDebug)) {
         VerboseVisitorUserData u = { 0, "<VerboseVisitor " + mClangLine + ">\n", this };
@@ -1543,6 +1843,181 @@ bool ClangIndexer::visit()
     return true;
 }
 
+void ClangIndexer::visitCursors()
+{
+    clang_visitChildren(clang_getTranslationUnitCursor(mClangUnit),
+                        ClangIndexer::indexVisitor, this);
+}
+
+bool ClangIndexer::indexEntities()
+{
+    // Macros and inclusion directives aren't reported through
+    // IndexerCallbacks. They're all children of the translation unit so we
+    // pick them up without recursing into anything else.
+    clang_visitChildren(clang_getTranslationUnitCursor(mClangUnit),
+                        ClangIndexer::preprocessingVisitor, this);
+
+    IndexerCallbacks callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.indexDeclaration = ClangIndexer::indexDeclaration;
+    callbacks.indexEntityReference = ClangIndexer::indexEntityReference;
+    CXIndexAction action = clang_IndexAction_create(mIndex);
+    const int ret = clang_indexTranslationUnit(action, this, &callbacks, sizeof(callbacks),
+                                               CXIndexOpt_IndexFunctionLocalSymbols, mClangUnit);
+    clang_IndexAction_dispose(action);
+    return !ret;
+}
+
+CXChildVisitResult ClangIndexer::preprocessingVisitor(CXCursor cursor, CXCursor parent, CXClientData data)
+{
+    if (clang_isPreprocessing(clang_getCursorKind(cursor)))
+        indexVisitor(cursor, parent, data);
+    return CXChildVisit_Continue;
+}
+
+void ClangIndexer::indexDeclaration(CXClientData data, const CXIdxDeclInfo *info)
+{
+    ClangIndexer *indexer = static_cast<ClangIndexer*>(data);
+    const CXCursor cursor = info->cursor;
+    const CXCursorKind kind = clang_getCursorKind(cursor);
+    if (RTags::cursorType(kind) != RTags::Type_Cursor)
+        return;
+
+    // there's no way to skip a subtree here so declarations in blocked files
+    // are still reported, we just ignore them
+    bool blocked = false;
+    const Location loc = indexer->createLocation(cursor, &blocked);
+    if (blocked) {
+        ++indexer->mBlocked;
+        return;
+    } else if (loc.isNull()) {
+        return;
+    }
+    ++indexer->mAllowed;
+
+    const Updater<CXCursor> lastCursorUpdater(indexer->mLastCursor, cursor);
+    if (Symbol::isClass(kind))
+        indexer->mLastClass = loc;
+    indexer->handleCursor(cursor, kind, loc);
+    if (const CXIdxCXXClassDeclInfo *classInfo = clang_index_getCXXClassDeclInfo(info)) {
+        for (unsigned int i=0; i<classInfo->numBases; ++i)
+            indexer->handleBaseClassSpecifier(classInfo->bases[i]->cursor);
+    }
+}
+
+void ClangIndexer::indexEntityReference(CXClientData data, const CXIdxEntityRefInfo *info)
+{
+    ClangIndexer *indexer = static_cast<ClangIndexer*>(data);
+    const CXCursor cursor = info->cursor;
+    const CXCursorKind kind = clang_getCursorKind(cursor);
+    if (RTags::cursorType(kind) != RTags::Type_Reference || !info->referencedEntity)
+        return;
+
+    bool blocked = false;
+    const Location loc = indexer->createLocation(cursor, &blocked);
+    if (blocked) {
+        ++indexer->mBlocked;
+        return;
+    } else if (loc.isNull()) {
+        return;
+    }
+    ++indexer->mAllowed;
+
+    // We don't know the lexical parent here, only the semantic container, so
+    // the hacks in handleReference that look at the parent don't kick in.
+    const Updater<CXCursor> lastCursorUpdater(indexer->mLastCursor, cursor);
+    indexer->handleReference(cursor, kind, loc, info->referencedEntity->cursor, nullCursor);
+}
+
+template <typename Key, typename Value, typename Equal>
+static inline String compareMaps(const char *name, const Map<Key, Value> &a, const Map<Key, Value> &b, Equal equal)
+{
+    int missing = 0, different = 0, extra = 0;
+    for (const auto &it : a) {
+        const auto other = b.find(it.first);
+        if (other == b.end()) {
+            ++missing;
+        } else if (!equal(it.second, other->second)) {
+            ++different;
+        }
+    }
+    for (const auto &it : b) {
+        if (!a.contains(it.first))
+            ++extra;
+    }
+    if (!missing && !different && !extra)
+        return String();
+    return String::format<128>(" %s: %d vs %d (%d missing, %d extra, %d different)",
+                               name, static_cast<int>(a.size()), static_cast<int>(b.size()),
+                               missing, extra, different);
+}
+
+void ClangIndexer::compareEngines()
+{
+    // Index the unit again with the engine we didn't use and log the time it
+    // took and how its maps differ from ours. Only for benchmarking, see
+    // tests/compare-indexers.sh. The second run doesn't have to ask rdm
+    // about files it has already seen so its time is slightly flattered. It
+    // never asks about new ones either, anything the first run didn't see is
+    // treated as blocked so it can't claim files rdm would then wait for.
+    const bool callbacks = !(sServerOpts & Server::IndexerCallbacks);
+    const auto includes = mIndexDataMessage.includes();
+    const auto declarations = mIndexDataMessage.declarations();
+    const auto files = mIndexDataMessage.files();
+    const auto sourceFileIncludes = mSourceFileIncludes;
+    const int blocked = mBlocked, allowed = mAllowed, indexed = mIndexed, queried = mFileIdsQueried;
+    Hash<uint32_t, std::shared_ptr<Unit> > units;
+    std::swap(units, mUnits);
+
+    StopWatch watch;
+    mComparing = true;
+    if (callbacks) {
+        indexEntities();
+    } else {
+        visitCursors();
+    }
+    mComparing = false;
+    const int duration = watch.elapsed();
+
+    std::swap(units, mUnits);
+    mIndexDataMessage.includes() = includes;
+    mIndexDataMessage.declarations() = declarations;
+    mIndexDataMessage.files() = files;
+    mSourceFileIncludes = sourceFileIncludes;
+    mBlocked = blocked;
+    mAllowed = allowed;
+    mIndexed = indexed;
+    mFileIdsQueried = queried;
+
+    String differences;
+    const Unit empty;
+    Set<uint32_t> fileIds;
+    for (const auto &it : mUnits)
+        fileIds.insert(it.first);
+    for (const auto &it : units)
+        fileIds.insert(it.first);
+    for (uint32_t file : fileIds) {
+        const std::shared_ptr<Unit> ours = mUnits.value(file), theirs = units.value(file);
+        const Unit &a = ours ? *ours : empty;
+        const Unit &b = theirs ? *theirs : empty;
+        String out;
+        out += compareMaps("symbols", a.symbols, b.symbols, [](const Symbol &l, const Symbol &r) {
+                return l.toString() == r.toString();
+            });
+        out += compareMaps("targets", a.targets, b.targets, std::equal_to<Map<String, uint16_t> >());
+        out += compareMaps("usrs", a.usrs, b.usrs, std::equal_to<Set<Location> >());
+        out += compareMaps("symbolNames", a.symbolNames, b.symbolNames, std::equal_to<Set<Location> >());
+        if (!out.isEmpty())
+            differences += "\n  " + Location::path(file) + out;
+    }
+
+    const String timing = String::format<128>("visitChildren %dms, indexer callbacks %dms",
+                                              callbacks ? mVisitDuration : duration,
+                                              callbacks ? duration : mVisitDuration);
+    error() << "Indexer comparison for" << mSourceFile << timing
+            << (differences.isEmpty() ? String("identical") : differences);
+}
+
 CXChildVisitResult ClangIndexer::verboseVisitor(CXCursor cursor, CXCursor, CXClientData userData)
 {
     VerboseVisitorUserData *u = reinterpret_cast<VerboseVisitorUserData*>(userData);
@@ -22,6 +22,7 @@
 #include <rct/Path.h>
 #include <rct/Connection.h>
 #include <sys/stat.h>
+#include "IndexCache.h"
 #include "IndexDataMessage.h"
 #include "IndexerJob.h"
 #include "RTagsClang.h"
@@ -35,7 +36,8 @@ public:
     static const CXSourceLocation nullLocation;
     static const CXCursor nullCursor;
 
-    ClangIndexer();
+    // index is shared between the jobs of a batch, if 0 we create our own
+    ClangIndexer(CXIndex index = 0);
     ~ClangIndexer();
 
     bool exec(const String &data);
@@ -43,8 +45,16 @@ public:
 private:
     bool diagnose();
     bool visit();
+    void visitCursors();
+    bool indexEntities();
+    void compareEngines();
     bool parse();
-    bool writeFiles(const Path &root, String &error);
+    void hashFiles(uint64_t parseTime);
+    void findLeadingIncludes();
+    bool writeFiles(const Path &root, String &error, Hash<uint32_t, Hash<String, String> > *written = 0);
+    bool loadFromCache(const IndexCache &cache, uint64_t manifestKey);
+    void storeInCache(IndexCache &cache, uint64_t manifestKey, uint64_t parseTime,
+                      const Hash<uint32_t, Hash<String, String> > &maps);
 
     void addFileSymbol(uint32_t file);
     int symbolLength(CXCursorKind kind, const CXCursor &cursor);
@@ -132,6 +142,9 @@ private:
                                                   const CXCursor &parent, Symbol **cursorPtr = 0);
     static CXChildVisitResult indexVisitor(CXCursor cursor, CXCursor parent, CXClientData client_data);
     static CXChildVisitResult verboseVisitor(CXCursor cursor, CXCursor, CXClientData userData);
+    static CXChildVisitResult preprocessingVisitor(CXCursor cursor, CXCursor parent, CXClientData data);
+    static void indexDeclaration(CXClientData data, const CXIdxDeclInfo *info);
+    static void indexEntityReference(CXClientData data, const CXIdxEntityRefInfo *info);
     static CXChildVisitResult resolveAutoTypeRefVisitor(CXCursor cursor, CXCursor, CXClientData data);
 
     void onMessage(const std::shared_ptr<Message> &msg, const std::shared_ptr<Connection> &conn);
@@ -155,6 +168,10 @@ private:
     Symbol findSymbol(const Location &location, bool *ok) const;
 
     Hash<uint32_t, std::shared_ptr<Unit> > mUnits;
+    // line -> included file for the #include lines in the source file
+    Map<unsigned int, uint32_t> mSourceFileIncludes;
+    // encoded FileMaps from the index cache
+    Hash<uint32_t, Hash<String, String> > mCachedMaps;
 
     Path mProject;
     Source mSource;
@@ -162,6 +179,7 @@ private:
     IndexDataMessage mIndexDataMessage;
     CXTranslationUnit mClangUnit;
     CXIndex mIndex;
+    bool mOwnsIndex;
     CXCursor mLastCursor;
     Location mLastClass;
     String mClangLine;
@@ -177,6 +195,7 @@ private:
     uint32_t mLastFileId;
     bool mLastBlocked;
     Path mLastFile;
+    bool mComparing; // second run for RTAGS_COMPARE_INDEXERS, mustn't claim files
 
     static Flags<Server::Option> sServerOpts;
 };
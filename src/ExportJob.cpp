@@ -0,0 +1,175 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "ExportJob.h"
+#include "Project.h"
+#include <rct/Connection.h>
+#include <rct/EventLoop.h>
+#include <rct/SignalSlot.h>
+#include <rct/Value.h>
+#include <algorithm>
+#include <condition_variable>
+
+ExportJob::ExportJob(uint32_t cursor, const std::shared_ptr<QueryMessage> &query,
+                     const std::shared_ptr<Project> &project)
+    : QueryJob(query, project), mCursor(cursor)
+{
+}
+
+int ExportJob::execute()
+{
+    // only this many files are held in memory at a time
+    enum { FilesPerBatch = 256 };
+
+    List<uint32_t> files;
+    for (uint32_t fileId : project()->visitedFiles()) {
+        if (fileId >= mCursor)
+            files.append(fileId);
+    }
+    std::sort(files.begin(), files.end());
+
+    // --max limits the number of files, a cursor line says where to resume
+    const int max = queryMessage()->max();
+    const int end = max > 0 ? std::min(max, files.size()) : files.size();
+    for (int i=0; i<end; i += FilesPerBatch) {
+        List<uint32_t> batch;
+        for (int j=i; j<end && j<i + FilesPerBatch; ++j)
+            batch.append(files.at(j));
+
+        std::mutex mutex;
+        Hash<uint32_t, String> output;
+        project()->scanFiles(batch, [this, &mutex, &output](uint32_t fileId, Set<Symbol> &) {
+                String out = exportFile(fileId);
+                std::lock_guard<std::mutex> lock(mutex);
+                output[fileId] = std::move(out);
+            });
+        for (uint32_t fileId : batch) {
+            const String &out = output[fileId];
+            if (!out.isEmpty() && !write(out, IgnoreMax|Unfiltered|DontQuote))
+                return 1;
+        }
+        if (!drain())
+            return 1;
+    }
+    if (end < files.size()) {
+        Value cursor;
+        cursor["cursor"] = static_cast<int>(files.at(end));
+        write(cursor.toJSON(), IgnoreMax|Unfiltered|DontQuote);
+    }
+    return 0;
+}
+
+String ExportJob::exportFile(uint32_t fileId) const
+{
+    auto symbols = project()->openSymbols(fileId);
+    if (!symbols)
+        return String();
+
+    // the targets map is usr -> the locations in this file that reference it
+    Map<Location, List<Value> > targets;
+    if (auto fileTargets = project()->openTargets(fileId)) {
+        const int count = fileTargets->count();
+        for (int i=0; i<count; ++i) {
+            const String usr = fileTargets->keyAt(i);
+            for (const Location &loc : fileTargets->valueAt(i))
+                targets[loc].append(usr);
+        }
+    }
+
+    Value file;
+    file["file"] = Location::path(fileId);
+    file["fileId"] = static_cast<int>(fileId);
+    String out = file.toJSON();
+
+    const int count = symbols->count();
+    for (int i=0; i<count; ++i) {
+        const Symbol symbol = symbols->valueAt(i);
+        Value value;
+        value["fileId"] = static_cast<int>(fileId);
+        value["line"] = static_cast<int>(symbol.location.line());
+        value["column"] = static_cast<int>(symbol.location.column());
+        value["length"] = static_cast<int>(symbol.symbolLength);
+        value["kind"] = symbol.kindSpelling();
+        value["definition"] = symbol.isDefinition();
+        value["name"] = symbol.symbolName;
+        if (!symbol.usr.isEmpty())
+            value["usr"] = symbol.usr;
+        if (!symbol.typeName.isEmpty())
+            value["type"] = symbol.typeName;
+        if (!symbol.baseClasses.isEmpty()) {
+            List<Value> baseClasses;
+            for (const String &usr : symbol.baseClasses)
+                baseClasses.append(usr);
+            value["baseClasses"] = baseClasses;
+        }
+        auto it = targets.find(symbol.location);
+        if (it != targets.end())
+            value["targets"] = it->second;
+        out += '\n';
+        out += value.toJSON();
+    }
+    return out;
+}
+
+// Waits until the client has read everything sent so far so the export can't
+// get ahead of it. The socket stays asynchronous, the main thread wakes us up
+// when the connection's write buffer is empty or the client goes away.
+bool ExportJob::drain()
+{
+    if (!flush())
+        return false;
+    if (EventLoop::isMainThread())
+        return !isAborted();
+
+    struct State {
+        State() : done(false) {}
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool done;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    auto wake = [state]() {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->done = true;
+        state->condition.notify_one();
+    };
+    // queued behind the writes flush() posted
+    std::weak_ptr<Connection> weak = connection();
+    EventLoop::mainEventLoop()->callLater([weak, wake]() {
+            std::shared_ptr<Connection> conn = weak.lock();
+            if (!conn || !conn->pendingWrite()) {
+                wake();
+                return;
+            }
+            typedef Signal<std::function<void(const std::shared_ptr<Connection> &)> >::Key Key;
+            std::shared_ptr<std::pair<Key, Key> > keys = std::make_shared<std::pair<Key, Key> >();
+            auto done = [weak, wake, keys](const std::shared_ptr<Connection> &) {
+                wake();
+                // not from within the signal that's calling us
+                EventLoop::mainEventLoop()->callLater([weak, keys]() {
+                        if (std::shared_ptr<Connection> c = weak.lock()) {
+                            c->sendComplete().disconnect(keys->first);
+                            c->disconnected().disconnect(keys->second);
+                        }
+                    });
+            };
+            keys->first = conn->sendComplete().connect(done);
+            keys->second = conn->disconnected().connect(done);
+        });
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (!state->done)
+        state->condition.wait(lock);
+    return !isAborted();
+}
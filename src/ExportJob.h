@@ -0,0 +1,40 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef ExportJob_h
+#define ExportJob_h
+
+#include <rct/String.h>
+#include "QueryJob.h"
+
+// Every symbol of the project as newline delimited JSON, one object per
+// line, files in fileId order. Each file starts with a line naming its path
+// and fileId, followed by a line per symbol with its usr and, for
+// references, the usrs of their targets. An export that stops early can be
+// resumed by passing the fileId of the last file line as the cursor.
+class ExportJob : public QueryJob
+{
+public:
+    ExportJob(uint32_t cursor, const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Project> &project);
+protected:
+    virtual int execute() override;
+private:
+    String exportFile(uint32_t fileId) const;
+    bool drain();
+
+    const uint32_t mCursor;
+};
+
+#endif
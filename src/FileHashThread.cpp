@@ -0,0 +1,38 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "FileHashThread.h"
+#include "RTags.h"
+
+FileHashThread::FileHashThread(const Hash<uint32_t, Path> &files)
+    : Thread(), mFiles(files)
+{
+}
+
+void FileHashThread::run()
+{
+    Hash<uint32_t, RTags::FileHash> hashes;
+    for (const auto &it : mFiles) {
+        const uint64_t lastModified = it.second.lastModifiedMs();
+        if (!lastModified)
+            continue;
+        RTags::FileHash &hash = hashes[it.first];
+        hash.hash = RTags::contentHash(it.second.readAll());
+        // modified while we read it, whatever we got can't be trusted to
+        // stand for that time
+        hash.lastModified = it.second.lastModifiedMs() == lastModified ? lastModified : 0;
+    }
+    mFinished(hashes);
+}
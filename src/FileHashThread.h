@@ -0,0 +1,36 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef FileHashThread_h
+#define FileHashThread_h
+
+#include <rct/Thread.h>
+#include <rct/Path.h>
+#include <rct/SignalSlot.h>
+#include "RTags.h"
+
+class FileHashThread : public Thread
+{
+public:
+    FileHashThread(const Hash<uint32_t, Path> &files);
+    virtual void run() override;
+    // the hashes with the modification time each file had before it was read
+    Signal<std::function<void(Hash<uint32_t, RTags::FileHash>)> > &finished() { return mFinished; }
+private:
+    const Hash<uint32_t, Path> mFiles;
+    Signal<std::function<void(Hash<uint32_t, RTags::FileHash>)> > mFinished;
+};
+
+#endif
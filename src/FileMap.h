@@ -229,6 +229,11 @@ public:
         return out;
     }
     static bool write(const Path &path, const Map<Key, Value> &map)
+    {
+        return writeData(path, encode(map));
+    }
+    // writes the output of encode()
+    static bool writeData(const Path &path, const String &data)
     {
         FILE *f = fopen(path.constData(), "w+");
         if (!f && Path::mkdir(path.parentDir(), Path::Recursive)) {
@@ -243,14 +248,13 @@ public:
             return false;
         }
 
-        const String data = encode(map);
         bool ret = fwrite(data.constData(), data.size(), 1, f);
         if (ret)
             eintrwrap(err, ftruncate(fd, data.size()));
         ret = lock(fd, Unlock) && ret;
         fclose(f);
         if (!ret)
-            unlink(data.constData());
+            unlink(path.constData());
         return ret;
     }
 private:
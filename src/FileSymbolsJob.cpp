@@ -0,0 +1,115 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "FileSymbolsJob.h"
+#include "Project.h"
+
+FileSymbolsJob::FileSymbolsJob(uint32_t fileId, const std::shared_ptr<QueryMessage> &query,
+                               const std::shared_ptr<Project> &project)
+    : QueryJob(query, project), mFileId(fileId)
+{
+}
+
+int FileSymbolsJob::execute()
+{
+    auto symbols = project()->openSymbols(mFileId);
+    if (!symbols || !symbols->count())
+        return 1;
+
+    const int minLine = queryMessage()->minLine();
+    const int maxLine = queryMessage()->maxLine();
+    uint32_t idx = 0;
+    if (minLine != -1) {
+        idx = symbols->lowerBound(Location(mFileId, minLine, 1));
+        if (idx == static_cast<uint32_t>(-1))
+            return 1;
+    }
+
+    uint32_t end = symbols->count();
+    if (maxLine != -1) {
+        for (uint32_t i=idx; i<end; ++i) {
+            if (symbols->keyAt(i).line() > maxLine) {
+                end = i;
+                break;
+            }
+        }
+    }
+    if (idx >= end)
+        return 1;
+
+    // the file's targets map says what each reference points to
+    Map<Location, String> targetUsrs;
+    Set<String> usrs;
+    if (auto targets = project()->openTargets(mFileId)) {
+        const Location first = symbols->keyAt(idx), last = symbols->keyAt(end - 1);
+        const uint32_t count = targets->count();
+        for (uint32_t i=0; i<count; ++i) {
+            const String usr = targets->keyAt(i);
+            for (const Location &loc : targets->valueAt(i)) {
+                if (!(loc < first) && !(last < loc)) {
+                    targetUsrs[loc] = usr;
+                    usrs.insert(usr);
+                }
+            }
+        }
+    }
+    resolveTargetKinds(usrs);
+
+    bool found = false;
+    for (uint32_t i=idx; i<end; ++i) {
+        const Location loc = symbols->keyAt(i);
+        const Symbol symbol = symbols->valueAt(i);
+        String targetKind = "-";
+        if (symbol.isReference()) {
+            const CXCursorKind kind = mTargetKinds.value(targetUsrs.value(loc), CXCursor_FirstInvalid);
+            if (kind != CXCursor_FirstInvalid)
+                targetKind = Symbol::kindSpelling(kind);
+        }
+        if (!write<256>(Unfiltered, "%d:%d\t%d\t%s\t%d\t%s", loc.line(), loc.column(), symbol.symbolLength,
+                        symbol.kindSpelling().constData(), symbol.isDefinition(), targetKind.constData())) {
+            break;
+        }
+        found = true;
+        if (isAborted())
+            return 1;
+    }
+    return found ? 0 : 1;
+}
+
+void FileSymbolsJob::resolveTargetKinds(Set<String> usrs)
+{
+    for (uint32_t file : project()->dependencies(mFileId, Project::ArgDependsOn)) {
+        if (usrs.isEmpty() || isAborted())
+            break;
+        auto fileUsrs = project()->openUsrs(file);
+        if (!fileUsrs)
+            continue;
+        auto it = usrs.begin();
+        while (it != usrs.end()) {
+            Symbol target;
+            for (const Location &loc : fileUsrs->value(*it)) {
+                target = project()->findSymbol(loc);
+                if (!target.isNull())
+                    break;
+            }
+            if (target.isNull()) {
+                ++it;
+            } else {
+                mTargetKinds[*it] = target.kind;
+                usrs.erase(it++);
+            }
+        }
+    }
+}
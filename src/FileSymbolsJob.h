@@ -0,0 +1,43 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef FileSymbolsJob_h
+#define FileSymbolsJob_h
+
+#include <rct/Hash.h>
+#include <rct/Map.h>
+#include <rct/Set.h>
+#include <rct/String.h>
+#include "QueryJob.h"
+
+// Every symbol of a file within the query's line range, one per line:
+// line:column, length, kind, definition and, for references, the kind of
+// their target. Meant for semantic highlighting of an editor's viewport.
+class FileSymbolsJob : public QueryJob
+{
+public:
+    FileSymbolsJob(uint32_t fileId, const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Project> &project);
+protected:
+    virtual int execute() override;
+private:
+    // looks the usrs up in the file and the files it includes, not in the
+    // whole project
+    void resolveTargetKinds(Set<String> usrs);
+
+    const uint32_t mFileId;
+    Hash<String, CXCursorKind> mTargetKinds; // usr -> kind
+};
+
+#endif
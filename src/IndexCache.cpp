@@ -0,0 +1,364 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "IndexCache.h"
+#include "FileMap.h"
+#include "RTags.h"
+#include "Symbol.h"
+#include <rct/DataFile.h>
+#include <rct/Log.h>
+#include <rct/Rct.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+enum { MaxManifestEntries = 16 };
+
+// Serializes the read-modify-write of manifests between the rp processes
+// sharing the cache. fcntl() locks go away with the process, a crashed rp
+// can't leave the cache locked.
+class CacheLock
+{
+public:
+    CacheLock(const Path &dir)
+    {
+        const Path path = dir + "lock";
+        eintrwrap(mFD, open(path.constData(), O_RDWR|O_CREAT, 0644));
+        if (mFD == -1) {
+            error() << "Can't open index cache lock" << path << Rct::strerror();
+            return;
+        }
+        struct flock fl;
+        memset(&fl, 0, sizeof(fl));
+        fl.l_type = F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        int ret;
+        eintrwrap(ret, fcntl(mFD, F_SETLKW, &fl));
+        if (ret == -1)
+            error() << "Can't lock index cache" << path << Rct::strerror();
+    }
+
+    ~CacheLock()
+    {
+        if (mFD != -1) {
+            int ret;
+            eintrwrap(ret, close(mFD));
+        }
+    }
+private:
+    int mFD;
+};
+
+IndexCache::IndexCache(const Path &dir, uint64_t maxSize, const Path &root)
+    : mDir(dir.ensureTrailingSlash()), mRoot(root.ensureTrailingSlash()), mMaxSize(maxSize)
+{
+}
+
+Path IndexCache::path(uint64_t key, const char *suffix) const
+{
+    return mDir + String::format<32>("%016llx.%s", static_cast<unsigned long long>(key), suffix);
+}
+
+Path IndexCache::relative(const Path &path) const
+{
+    if (path.startsWith(mRoot))
+        return path.mid(mRoot.size());
+    return path;
+}
+
+Path IndexCache::absolute(const Path &path) const
+{
+    if (path.isAbsolute())
+        return path;
+    return mRoot + path;
+}
+
+bool IndexCache::readManifest(const Path &path, Manifest &manifest)
+{
+    DataFile file(path, RTags::DatabaseVersion);
+    if (!file.open(DataFile::Read))
+        return false;
+    file.deserializer() >> manifest;
+    return true;
+}
+
+uint64_t IndexCache::manifestKey(const Source &source, const Path &sourceFile) const
+{
+    String data = relative(sourceFile);
+    const uint64_t fingerprint = source.fingerprint(mRoot);
+    const uint64_t contents = RTags::contentHash(sourceFile.readAll());
+    data.append(reinterpret_cast<const char *>(&fingerprint), sizeof(fingerprint));
+    data.append(reinterpret_cast<const char *>(&contents), sizeof(contents));
+    return RTags::contentHash(data);
+}
+
+// DataFile writes in place, write to a temporary file so a concurrent reader
+// never sees half a file
+template <typename T>
+static bool writeFile(const Path &path, const T &writer)
+{
+    const Path tmp = path + String::format<16>(".%d", getpid());
+    DataFile file(tmp, RTags::DatabaseVersion);
+    if (!file.open(DataFile::Write)) {
+        error() << "Can't write index cache file" << tmp << file.error();
+        return false;
+    }
+    writer(file.serializer());
+    if (!file.flush() || rename(tmp.constData(), path.constData())) {
+        unlink(tmp.constData());
+        return false;
+    }
+    return true;
+}
+
+bool IndexCache::find(uint64_t manifestKey, Result &result) const
+{
+    const Path manifestPath = path(manifestKey, "manifest");
+    Manifest manifest;
+    if (!readManifest(manifestPath, manifest))
+        return false;
+
+    Hash<Path, uint64_t> hashes;
+    for (const auto &entry : manifest) {
+        bool match = true;
+        for (const auto &dep : entry.second) {
+            auto it = hashes.find(dep.first);
+            if (it == hashes.end()) {
+                const Path file = absolute(dep.first);
+                const uint64_t hash = file.isFile() ? RTags::contentHash(file.readAll()) : 0;
+                it = hashes.insert(std::make_pair(dep.first, hash)).first;
+            }
+            if (it->second != dep.second) {
+                match = false;
+                break;
+            }
+        }
+        if (!match)
+            continue;
+
+        const Path resultPath = path(entry.first, "result");
+        DataFile file(resultPath, RTags::DatabaseVersion);
+        if (!file.open(DataFile::Read))
+            continue;
+        Deserializer &deserializer = file.deserializer();
+        result.message.decode(deserializer);
+        deserializer >> result.files >> result.maps;
+        for (auto &it : result.files)
+            it.second = absolute(it.second);
+        utimes(manifestPath.constData(), 0);
+        utimes(resultPath.constData(), 0);
+        return true;
+    }
+    return false;
+}
+
+bool IndexCache::insert(uint64_t manifestKey, const Dependencies &dependencies, const IndexDataMessage &message,
+                        const Hash<uint32_t, Path> &files, const Hash<uint32_t, Hash<String, String> > &maps)
+{
+    Path::mkdir(mDir, Path::Recursive);
+    Dependencies relativeDependencies = dependencies;
+    String data;
+    data.append(reinterpret_cast<const char *>(&manifestKey), sizeof(manifestKey));
+    for (auto &dep : relativeDependencies) {
+        dep.first = relative(dep.first);
+        data += dep.first;
+        data.append(reinterpret_cast<const char *>(&dep.second), sizeof(dep.second));
+    }
+    const uint64_t resultKey = RTags::contentHash(data);
+
+    Hash<uint32_t, Path> relativeFiles = files;
+    for (auto &file : relativeFiles)
+        file.second = relative(file.second);
+    if (!writeFile(path(resultKey, "result"), [&](Serializer &serializer) {
+                message.encode(serializer);
+                serializer << relativeFiles << maps;
+            })) {
+        return false;
+    }
+
+    CacheLock lock(mDir);
+    const Path manifestPath = path(manifestKey, "manifest");
+    Manifest manifest;
+    readManifest(manifestPath, manifest);
+    if (manifest.size() >= MaxManifestEntries) {
+        for (const auto &entry : manifest) {
+            if (entry.first != resultKey)
+                unlink(path(entry.first, "result").constData());
+        }
+        manifest.clear();
+    }
+    manifest[resultKey] = relativeDependencies;
+    if (!writeFile(manifestPath, [&manifest](Serializer &serializer) { serializer << manifest; }))
+        return false;
+
+    // only look at the size of the cache every now and then
+    if (!(resultKey % 64))
+        prune();
+    return true;
+}
+
+static inline Location remap(const Location &location, const Hash<uint32_t, uint32_t> &fileIds)
+{
+    if (location.isNull())
+        return location;
+    return Location(fileIds.value(location.fileId()), location.line(), location.column());
+}
+
+static String remapSymbols(const String &data, const Hash<uint32_t, uint32_t> &fileIds)
+{
+    FileMap<Location, Symbol> in;
+    in.init(data.constData(), data.size());
+    Map<Location, Symbol> out;
+    for (int i=0; i<in.count(); ++i) {
+        Symbol symbol = in.valueAt(i);
+        symbol.location = remap(symbol.location, fileIds);
+        out[remap(in.keyAt(i), fileIds)] = symbol;
+    }
+    return FileMap<Location, Symbol>::encode(out);
+}
+
+// targets, usrs and symnames
+static String remapLocations(const String &data, const Hash<uint32_t, uint32_t> &fileIds)
+{
+    FileMap<String, Set<Location> > in;
+    in.init(data.constData(), data.size());
+    Map<String, Set<Location> > out;
+    for (int i=0; i<in.count(); ++i) {
+        Set<Location> &locations = out[in.keyAt(i)];
+        for (const Location &location : in.valueAt(i))
+            locations.insert(remap(location, fileIds));
+    }
+    return FileMap<String, Set<Location> >::encode(out);
+}
+
+void IndexCache::remap(Result &result, const Hash<uint32_t, uint32_t> &fileIds)
+{
+    IndexDataMessage &message = result.message;
+    Hash<uint32_t, Flags<IndexDataMessage::FileFlag> > files;
+    for (const auto &file : message.files())
+        files[fileIds.value(file.first)] = file.second;
+    message.files() = files;
+
+    Hash<uint32_t, RTags::FileHash> fileHashes;
+    for (const auto &hash : message.fileHashes())
+        fileHashes[fileIds.value(hash.first)] = hash.second;
+    message.fileHashes() = fileHashes;
+
+    for (auto &include : message.includes()) {
+        include.first = fileIds.value(include.first);
+        include.second = fileIds.value(include.second);
+    }
+    for (uint32_t &fileId : message.leadingIncludes())
+        fileId = fileIds.value(fileId);
+
+    FixIts fixIts;
+    for (const auto &fixIt : message.fixIts())
+        fixIts[fileIds.value(fixIt.first)] = fixIt.second;
+    message.fixIts() = fixIts;
+
+    Diagnostics diagnostics;
+    for (const auto &diagnostic : message.diagnostics())
+        diagnostics[::remap(diagnostic.first, fileIds)] = diagnostic.second;
+    message.diagnostics() = diagnostics;
+
+    for (auto &declaration : message.declarations()) {
+        Set<uint32_t> declared;
+        for (uint32_t fileId : declaration.second)
+            declared.insert(fileIds.value(fileId));
+        declaration.second = declared;
+    }
+
+    Hash<uint32_t, Path> paths;
+    for (const auto &file : result.files)
+        paths[fileIds.value(file.first)] = file.second;
+    result.files = paths;
+
+    Hash<uint32_t, Hash<String, String> > maps;
+    for (const auto &file : result.maps) {
+        Hash<String, String> &remapped = maps[fileIds.value(file.first)];
+        for (const auto &map : file.second) {
+            remapped[map.first] = (map.first == "/symbols"
+                                   ? remapSymbols(map.second, fileIds)
+                                   : remapLocations(map.second, fileIds));
+        }
+    }
+    result.maps = maps;
+}
+
+void IndexCache::prune()
+{
+    Hash<Path, std::pair<time_t, uint64_t> > files; // path -> last used, size
+    uint64_t total = 0;
+    const Path lockPath = mDir + "lock";
+    for (const Path &file : mDir.files(Path::File)) {
+        struct stat st;
+        if (file != lockPath && !stat(file.constData(), &st)) {
+            files[file] = std::make_pair(st.st_mtime, static_cast<uint64_t>(st.st_size));
+            total += st.st_size;
+        }
+    }
+    if (total <= mMaxSize)
+        return;
+
+    // A manifest is evicted together with its results so we never keep a
+    // manifest whose results are gone or results nothing refers to. Other
+    // files, results whose manifest is being written and temporary files
+    // left by a crashed rp, go on their own.
+    struct Entry {
+        List<Path> paths;
+        time_t lastUsed;
+    };
+    List<Entry> entries;
+    Set<Path> grouped;
+    for (const auto &file : files) {
+        if (!file.first.endsWith(".manifest"))
+            continue;
+        Entry entry = { List<Path>() << file.first, file.second.first };
+        Manifest manifest;
+        readManifest(file.first, manifest);
+        for (const auto &result : manifest) {
+            const Path resultPath = path(result.first, "result");
+            const auto it = files.find(resultPath);
+            if (it != files.end()) {
+                entry.paths.append(resultPath);
+                entry.lastUsed = std::max(entry.lastUsed, it->second.first);
+                grouped.insert(resultPath);
+            }
+        }
+        entries.append(entry);
+    }
+    for (const auto &file : files) {
+        if (!file.first.endsWith(".manifest") && !grouped.contains(file.first))
+            entries.append({ List<Path>() << file.first, file.second.first });
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &l, const Entry &r) {
+            return l.lastUsed < r.lastUsed;
+        });
+    // leave some room so we don't have to do this again right away
+    const uint64_t target = mMaxSize / 10 * 9;
+    for (const Entry &entry : entries) {
+        if (total <= target)
+            break;
+        for (const Path &file : entry.paths) {
+            if (!unlink(file.constData()))
+                total -= files.value(file).second;
+        }
+    }
+    warning() << "Pruned index cache" << mDir << "to" << (total / (1024 * 1024)) << "MB";
+}
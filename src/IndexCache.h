@@ -0,0 +1,66 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef IndexCache_h
+#define IndexCache_h
+
+#include <rct/Hash.h>
+#include <rct/List.h>
+#include <rct/Path.h>
+#include <rct/String.h>
+#include "IndexDataMessage.h"
+#include "Source.h"
+
+// On-disk cache of what rp produces for a translation unit, keyed on the
+// arguments and the contents of every file in it. Like ccache a manifest,
+// keyed on the arguments and the source file, lists the sets of dependencies
+// seen for the source file and the result each of them produced. Files are
+// touched when they're used and the least recently used ones are removed when
+// the cache grows past its size.
+//
+// Paths below the project root are stored relative to it so a checkout of the
+// same tree somewhere else can use the entries, the file ids in a result are
+// the ones of the rdm that wrote it and have to be remapped with remap().
+class IndexCache
+{
+public:
+    IndexCache(const Path &dir, uint64_t maxSize, const Path &root);
+
+    typedef List<std::pair<Path, uint64_t> > Dependencies; // path, content hash
+    struct Result {
+        IndexDataMessage message;
+        Hash<uint32_t, Path> files; // every file in the translation unit
+        Hash<uint32_t, Hash<String, String> > maps; // fileId -> FileMap name -> encoded FileMap
+    };
+
+    uint64_t manifestKey(const Source &source, const Path &sourceFile) const;
+    bool find(uint64_t manifestKey, Result &result) const;
+    bool insert(uint64_t manifestKey, const Dependencies &dependencies, const IndexDataMessage &message,
+                const Hash<uint32_t, Path> &files, const Hash<uint32_t, Hash<String, String> > &maps);
+    // rewrites the file ids in result, fileIds maps the cached ids to the ones to use
+    static void remap(Result &result, const Hash<uint32_t, uint32_t> &fileIds);
+private:
+    typedef Hash<uint64_t, Dependencies> Manifest; // result key -> dependencies
+    Path path(uint64_t key, const char *suffix) const;
+    Path relative(const Path &path) const;
+    Path absolute(const Path &path) const;
+    static bool readManifest(const Path &path, Manifest &manifest);
+    void prune();
+
+    const Path mDir, mRoot;
+    const uint64_t mMaxSize;
+};
+
+#endif
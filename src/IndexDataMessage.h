@@ -86,6 +86,9 @@ public:
     uint64_t parseTime() const { return mParseTime; }
     void setParseTime(uint64_t parseTime) { mParseTime = parseTime; }
 
+    const IndexCost &cost() const { return mCost; }
+    void setCost(const IndexCost &cost) { mCost = cost; }
+
     Flags<IndexerJob::Flag> indexerJobFlags() const { return mIndexerJobFlags; }
     void setIndexerJobFlags(Flags<IndexerJob::Flag> flags) { mIndexerJobFlags = flags; }
 
@@ -105,6 +108,10 @@ public:
         HeaderError = 0x2
     };
     Hash<uint32_t, Flags<FileFlag> > &files() { return mFiles; }
+    // content hashes of the visited files that weren't modified during the parse
+    Hash<uint32_t, RTags::FileHash> &fileHashes() { return mFileHashes; }
+    // the files included by the #include lines the source file starts with, in order
+    List<uint32_t> &leadingIncludes() { return mLeadingIncludes; }
 private:
     Path mProject;
     uint64_t mParseTime, mKey, mId;
@@ -115,6 +122,9 @@ private:
     Includes mIncludes;
     Declarations mDeclarations; // function declarations and forward declaration
     Hash<uint32_t, Flags<FileFlag> > mFiles;
+    Hash<uint32_t, RTags::FileHash> mFileHashes;
+    List<uint32_t> mLeadingIncludes;
+    IndexCost mCost;
     Flags<Flag> mFlags;
 };
 
@@ -125,14 +135,14 @@ inline void IndexDataMessage::encode(Serializer &serializer) const
 {
     serializer << mProject << mParseTime << mKey << mId << mIndexerJobFlags
                << mMessage << mFixIts << mIncludes << mDiagnostics << mFiles
-               << mDeclarations << mFlags;
+               << mFileHashes << mLeadingIncludes << mCost << mDeclarations << mFlags;
 }
 
 inline void IndexDataMessage::decode(Deserializer &deserializer)
 {
     deserializer >> mProject >> mParseTime >> mKey >> mId >> mIndexerJobFlags
                  >> mMessage >> mFixIts >> mIncludes >> mDiagnostics
-                 >> mFiles >> mDeclarations >> mFlags;
+                 >> mFiles >> mFileHashes >> mLeadingIncludes >> mCost >> mDeclarations >> mFlags;
 }
 
 #endif
@@ -26,23 +26,30 @@ IndexerJob::IndexerJob(const Source &s,
                        const std::shared_ptr<Project> &p,
                        const UnsavedFiles &u)
     : id(0), source(s), sourceFile(s.sourceFile()), flags(f),
-      project(p->path()), priority(0), unsavedFiles(u), crashCount(0)
+      project(p->path()), priority(0), lane(BulkLane), cost(p->indexCost(s.key())),
+      unsavedFiles(u), crashCount(0)
 {
     acquireId();
-    if (flags & Dirty)
+    if (flags & Dirty) {
         ++priority;
+        lane = DirtyLane;
+    }
     Server *server = Server::instance();
     assert(server);
     if (server->isActiveBuffer(source.fileId)) {
         priority += 4;
+        lane = InteractiveLane;
     } else {
         for (uint32_t dep : p->dependencies(source.fileId, Project::ArgDependsOn)) {
             if (server->isActiveBuffer(dep)) {
                 priority += 2;
+                lane = InteractiveLane;
                 break;
             }
         }
     }
+    if (!unsavedFiles.isEmpty())
+        lane = InteractiveLane;
     visited.insert(s.fileId);
 }
 
@@ -56,60 +63,73 @@ void IndexerJob::acquireId()
     id = sNextId++;
 }
 
-String IndexerJob::encode() const
+Source IndexerJob::prepareSource(const Source &source)
 {
-    String ret;
-    {
-        Serializer serializer(ret);
-        serializer.write("1234", sizeof(int)); // for size
-        std::shared_ptr<Project> proj = Server::instance()->project(project);
-        const Server::Options &options = Server::instance()->options();
-        Source copy = source;
-        if ((options.flag(Server::Weverything) || options.flag(Server::Wall)) && source.arguments.contains("-Werror")) {
-            for (const auto &arg : options.defaultArguments) {
-                if (arg != "-Wall" && arg != "-Weverything")
-                    copy.arguments << arg;
-            }
-        } else {
-            copy.arguments << options.defaultArguments;
+    const Server::Options &options = Server::instance()->options();
+    Source copy = source;
+    if ((options.flag(Server::Weverything) || options.flag(Server::Wall)) && source.arguments.contains("-Werror")) {
+        for (const auto &arg : options.defaultArguments) {
+            if (arg != "-Wall" && arg != "-Weverything")
+                copy.arguments << arg;
         }
+    } else {
+        copy.arguments << options.defaultArguments;
+    }
 
-        if (!options.flag(Server::AllowPedantic)) {
-            const int idx = copy.arguments.indexOf("-Wpedantic");
-            if (idx != -1) {
-                copy.arguments.removeAt(idx);
-            }
+    if (!options.flag(Server::AllowPedantic)) {
+        const int idx = copy.arguments.indexOf("-Wpedantic");
+        if (idx != -1) {
+            copy.arguments.removeAt(idx);
         }
+    }
 
-        if (options.flag(Server::EnableCompilerManager))
-            CompilerManager::applyToSource(copy, false, true);
-
-        for (const String &blocked : options.blockedArguments) {
-            if (blocked.endsWith("=")) {
-                int i = 0;
-                while (i<copy.arguments.size()) {
-                    if (copy.arguments.at(i).startsWith(blocked)) {
-                        // error() << "Removing" << copy.arguments.at(i);
-                        copy.arguments.remove(i, 1);
-                    } else if (!strncmp(blocked.constData(), copy.arguments.at(i).constData(), blocked.size() - 1)) {
-                        const int count = i + 1 < copy.arguments.size() ? 2 : 1;
-                        // error() << "Removing" << copy.arguments.mid(i, count);
-                        copy.arguments.remove(i, count);
-                    } else {
-                        ++i;
-                    }
+    if (options.flag(Server::EnableCompilerManager))
+        CompilerManager::applyToSource(copy, false, true);
+
+    for (const String &blocked : options.blockedArguments) {
+        if (blocked.endsWith("=")) {
+            int i = 0;
+            while (i<copy.arguments.size()) {
+                if (copy.arguments.at(i).startsWith(blocked)) {
+                    // error() << "Removing" << copy.arguments.at(i);
+                    copy.arguments.remove(i, 1);
+                } else if (!strncmp(blocked.constData(), copy.arguments.at(i).constData(), blocked.size() - 1)) {
+                    const int count = i + 1 < copy.arguments.size() ? 2 : 1;
+                    // error() << "Removing" << copy.arguments.mid(i, count);
+                    copy.arguments.remove(i, count);
+                } else {
+                    ++i;
                 }
-            } else {
-                copy.arguments.remove(blocked);
             }
+        } else {
+            copy.arguments.remove(blocked);
         }
+    }
 
-        for (const auto &inc : options.includePaths) {
-            copy.includePaths << inc;
-        }
-        copy.defines << options.defines;
-        if (!(options.flag(Server::EnableNDEBUG))) {
-            copy.defines.remove(Source::Define("NDEBUG"));
+    for (const auto &inc : options.includePaths) {
+        copy.includePaths << inc;
+    }
+    copy.defines << options.defines;
+    if (!(options.flag(Server::EnableNDEBUG))) {
+        copy.defines.remove(Source::Define("NDEBUG"));
+    }
+    return copy;
+}
+
+String IndexerJob::encode() const
+{
+    String ret;
+    {
+        Serializer serializer(ret);
+        serializer.write("1234", sizeof(int)); // for size
+        std::shared_ptr<Project> proj = Server::instance()->project(project);
+        const Server::Options &options = Server::instance()->options();
+        Source copy = prepareSource(source);
+        if (proj && unsavedFiles.isEmpty()) {
+            // unsaved files might be in the pch
+            const Path pch = proj->pch(copy);
+            if (!pch.isEmpty())
+                copy.arguments << "-include-pch" << pch;
         }
         assert(!sourceFile.isEmpty());
         serializer << static_cast<uint16_t>(RTags::DatabaseVersion)
@@ -126,7 +146,9 @@ String IndexerJob::encode() const
                    << static_cast<int32_t>(options.rpNiceValue)
                    << options.options
                    << unsavedFiles
-                   << options.dataDir;
+                   << options.dataDir
+                   << options.indexCacheDir
+                   << (static_cast<uint64_t>(options.indexCacheSize) * 1024 * 1024);
         assert(proj);
         proj->encodeVisitedFiles(serializer);
     }
@@ -135,6 +157,17 @@ String IndexerJob::encode() const
     return ret;
 }
 
+const char *IndexerJob::laneName(Lane lane)
+{
+    switch (lane) {
+    case InteractiveLane: return "interactive";
+    case DirtyLane: return "dirty";
+    case BulkLane: return "bulk";
+    case LaneCount: break;
+    }
+    return "";
+}
+
 String IndexerJob::dumpFlags(Flags<Flag> flags)
 {
     List<String> ret;
@@ -156,6 +189,12 @@ String IndexerJob::dumpFlags(Flags<Flag> flags)
     if (flags & Complete) {
         ret += "Complete";
     }
+    if (flags & OutOfMemory) {
+        ret += "OutOfMemory";
+    }
+    if (flags & RunAlone) {
+        ret += "RunAlone";
+    }
 
     return String::join(ret, ", ");
 }
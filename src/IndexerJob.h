@@ -25,6 +25,43 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "Source.h"
 #include <rct/Flags.h>
 
+// what indexing a Source cost the last time(s) it was indexed
+struct IndexCost
+{
+    IndexCost()
+        : duration(0), peakMemory(0), headerCount(0)
+    {}
+
+    uint32_t duration; // ms
+    uint64_t peakMemory; // bytes, max RSS of rp
+    uint32_t headerCount;
+
+    bool isNull() const { return !duration; }
+    void update(const IndexCost &cost)
+    {
+        if (isNull()) {
+            *this = cost;
+        } else {
+            // give the latest run and the history equal weight
+            duration = (duration + cost.duration) / 2;
+            peakMemory = (peakMemory + cost.peakMemory) / 2;
+            headerCount = cost.headerCount;
+        }
+    }
+};
+
+template <> inline Serializer &operator<<(Serializer &s, const IndexCost &cost)
+{
+    s << cost.duration << cost.peakMemory << cost.headerCount;
+    return s;
+}
+
+template <> inline Deserializer &operator>>(Deserializer &s, IndexCost &cost)
+{
+    s >> cost.duration >> cost.peakMemory >> cost.headerCount;
+    return s;
+}
+
 class IndexerJob
 {
 public:
@@ -32,15 +69,26 @@ public:
         None = 0x000,
         Dirty = 0x001,
         Compile = 0x002,
+        RunAlone = 0x004, // rp ran out of memory, run it without other rps and without --rp-memory-limit
         Running = 0x010,
         Crashed = 0x020,
         Aborted = 0x040,
         Complete = 0x080,
-        Type_Mask = Dirty|Compile
+        OutOfMemory = 0x100,
+        Type_Mask = Dirty|Compile|RunAlone
     };
 
     static String dumpFlags(Flags<Flag> flags);
 
+    // JobScheduler serves the lanes in this order
+    enum Lane {
+        InteractiveLane, // active buffers, unsaved files and clients waiting for the job
+        DirtyLane,
+        BulkLane,
+        LaneCount
+    };
+    static const char *laneName(Lane lane);
+
     IndexerJob(const Source &source,
                Flags<Flag> flags,
                const std::shared_ptr<Project> &project,
@@ -48,6 +96,8 @@ public:
     ~IndexerJob();
     void acquireId();
     String encode() const;
+    // the source with rdm's default arguments, defines and include paths applied
+    static Source prepareSource(const Source &source);
 
     uint64_t id;
     Source source;
@@ -56,6 +106,8 @@ public:
     Path project;
     int priority;
     enum { HeaderError = -1 };
+    Lane lane;
+    IndexCost cost; // from the previous run, null if unknown
     UnsavedFiles unsavedFiles;
     Set<uint32_t> visited;
     int crashCount;
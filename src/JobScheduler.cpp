@@ -16,16 +16,23 @@
 #include "JobScheduler.h"
 #include "Project.h"
 #include "Server.h"
+#include <rct/Rct.h>
 
 enum { MaxPriority = 10 };
+// how far into the pending jobs we look for jobs to batch with the one we're starting
+enum { MaxBatchScan = 256 };
 // we set the priority to be this when a job has been requested and we couldn't load it
 JobScheduler::JobScheduler()
-    : mProcrastination(0)
+    : mProcrastination(0), mFinishedDuration(0), mFinishedCount(0),
+      mJobLimit(0), mJobLimitTimer(-1)
 {}
 
 JobScheduler::~JobScheduler()
 {
-    mPendingJobs.deleteAll();
+    if (mJobLimitTimer != -1) {
+        if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop())
+            loop->unregisterTimer(mJobLimitTimer);
+    }
     if (!mActiveByProcess.isEmpty()) {
         for (const auto &job : mActiveByProcess) {
             job.first->kill();
@@ -36,26 +43,154 @@ JobScheduler::~JobScheduler()
 void JobScheduler::add(const std::shared_ptr<IndexerJob> &job)
 {
     assert(!(job->flags & ~IndexerJob::Type_Mask));
-    std::shared_ptr<Node> node(new Node({ job, 0, 0, 0 }));
-    node->job = job;
+    std::shared_ptr<Node> node(new Node({ job, 0, estimate(job), 0 }));
     // error() << job->priority << job->sourceFile << mProcrastination;
-    if (mPendingJobs.isEmpty() || job->priority > mPendingJobs.first()->job->priority) {
-        mPendingJobs.prepend(node);
-    } else {
-        std::shared_ptr<Node> after = mPendingJobs.last();
-        while (job->priority > after->job->priority) {
-            after = after->prev;
-            assert(after);
-        }
-        mPendingJobs.insert(node, after);
-    }
+    pendingJobs(job).insert(node);
     assert(!mInactiveById.contains(job->id));
     mInactiveById[job->id] = node;
+    startJobLimitTimer();
     // error() << "procrash" << mProcrastination << job->sourceFile;
     if (!mProcrastination)
         startJobs();
 }
 
+uint32_t JobScheduler::estimate(const std::shared_ptr<IndexerJob> &job) const
+{
+    if (!job->cost.isNull())
+        return job->cost.duration;
+    if (mFinishedCount)
+        return mFinishedDuration / mFinishedCount;
+    return 1000;
+}
+
+uint64_t JobScheduler::eta() const
+{
+    uint64_t work = 0;
+    for (int lane=0; lane<IndexerJob::LaneCount; ++lane) {
+        for (const auto &node : mPendingJobs[lane])
+            work += node->estimate;
+    }
+    const uint64_t now = Rct::currentTimeMs();
+    for (const auto &node : mActiveById) {
+        const uint64_t elapsed = now - node.second->started;
+        if (node.second->estimate > elapsed)
+            work += node.second->estimate - elapsed;
+    }
+    work /= std::max(1, jobLimit());
+    // these run one at a time
+    for (const auto &node : mRunAlone)
+        work += node->estimate;
+    return work;
+}
+
+// reads a "Key:   1234 kB" line from a /proc file
+static uint64_t procKilobytes(const String &contents, const char *key)
+{
+    const int idx = contents.indexOf(key);
+    if (idx == -1)
+        return 0;
+    unsigned long long kb = 0;
+    if (sscanf(contents.constData() + idx + strlen(key), ": %llu", &kb) != 1)
+        return 0;
+    return static_cast<uint64_t>(kb) * 1024;
+}
+
+int JobScheduler::jobLimit() const
+{
+    const auto &options = Server::instance()->options();
+    if (options.minJobCount >= options.jobCount || !mJobLimit)
+        return options.jobCount;
+    return std::max(options.minJobCount, std::min(mJobLimit, options.jobCount));
+}
+
+void JobScheduler::startJobLimitTimer()
+{
+    const auto &options = Server::instance()->options();
+    if (mJobLimitTimer != -1 || options.minJobCount >= options.jobCount)
+        return;
+    updateJobLimit();
+    mJobLimitTimer = EventLoop::eventLoop()->registerTimer([this](int) {
+            if (isIdle()) {
+                // nothing to schedule, add() starts it again
+                EventLoop::eventLoop()->unregisterTimer(mJobLimitTimer);
+                mJobLimitTimer = -1;
+                return;
+            }
+            updateJobLimit();
+            startJobs();
+        }, 1000);
+}
+
+bool JobScheduler::isIdle() const
+{
+    if (!mActiveByProcess.isEmpty() || !mRunAlone.empty())
+        return false;
+    for (int lane=0; lane<IndexerJob::LaneCount; ++lane) {
+        if (!mPendingJobs[lane].empty())
+            return false;
+    }
+    return true;
+}
+
+void JobScheduler::updateJobLimit()
+{
+    const auto &options = Server::instance()->options();
+    const int min = std::max(1, options.minJobCount);
+    const int max = options.jobCount;
+    if (min >= max) {
+        mJobLimit = 0;
+        mJobLimitReason = "fixed";
+        return;
+    }
+
+    Load load;
+    const String meminfo = Path("/proc/meminfo").readAll();
+    load.memTotal = procKilobytes(meminfo, "MemTotal");
+    load.memAvailable = procKilobytes(meminfo, "MemAvailable");
+    const String loadavg = Path("/proc/loadavg").readAll();
+    if (sscanf(loadavg.constData(), "%lf", &load.loadAverage) != 1)
+        load.loadAverage = 0;
+    const bool memoryPressure = load.memTotal && load.memAvailable < load.memTotal / 10;
+    for (const auto &active : mActiveByProcess) {
+        const String status = Path(String::format<32>("/proc/%d/status", active.first->pid())).readAll();
+        if (const uint64_t rss = procKilobytes(status, "VmRSS")) {
+            load.rpMemory += rss;
+            ++load.rpCount;
+        }
+        // for telling a kill by the OOM killer from other crashes
+        Indexing &indexing = mIndexing[active.first];
+        indexing.peakMemory = procKilobytes(status, "VmPeak");
+        indexing.memoryPressure = memoryPressure;
+    }
+    mLoad = load;
+
+    if (!load.memTotal) {
+        mJobLimit = 0;
+        mJobLimitReason = "no /proc/meminfo";
+        return;
+    }
+
+    int limit = mJobLimit ? mJobLimit : min;
+    const int running = mActiveByProcess.size();
+    // what another rp is likely to need
+    const uint64_t perJob = load.rpCount ? load.rpMemory / load.rpCount : 0;
+    const int cores = std::max(1, ThreadPool::idealThreadCount());
+    if (memoryPressure || load.memAvailable < perJob) {
+        limit = std::max(min, std::min(limit, running) - 1);
+        mJobLimitReason = "backing off, memory pressure";
+    } else if (load.loadAverage > cores * 1.5) {
+        limit = std::max(min, std::min(limit, running) - 1);
+        mJobLimitReason = "backing off, high load";
+    } else if (running >= limit && load.loadAverage < cores
+               && load.memAvailable > load.memTotal / 5 + 2 * perJob) {
+        limit = std::min(max, limit + 1);
+        mJobLimitReason = "ramping up";
+    } else {
+        mJobLimitReason = "steady";
+    }
+    mJobLimit = limit;
+}
+
 uint32_t JobScheduler::hasHeaderError(DependencyNode *node, Set<uint32_t> &seen) const
 {
     assert(node);
@@ -97,14 +232,100 @@ void JobScheduler::startJobs()
     }
 
     const auto &options = Server::instance()->options();
-    std::shared_ptr<Node> node = mPendingJobs.first();
-    auto cont = [&node, this]() {
-        auto tmp = node->next;
-        mPendingJobs.remove(node);
-        node = tmp;
-    };
-
-    while (mActiveByProcess.size() < options.jobCount && node) {
+    const int limit = jobLimit();
+    // the reserved slots can only be used by the interactive lane
+    const int reserved = std::max(0, std::min(options.reservedJobCount, limit - 1));
+    int alone = 0, other = 0;
+    for (const auto &active : mActiveByProcess) {
+        const std::shared_ptr<IndexerJob> &job = active.second.first()->job;
+        if (job->flags & IndexerJob::RunAlone) {
+            ++alone;
+        } else if (job->lane != IndexerJob::InteractiveLane) {
+            ++other;
+        }
+    }
+    if (alone || !mRunAlone.empty()) {
+        // let the other rps drain, then give the machine to the job that ran
+        // out of memory. The interactive lane keeps its reserved slots, at
+        // least one, so editing doesn't wait for it.
+        if (!alone && !other) {
+            const int active = mActiveByProcess.size();
+            startJobs(mRunAlone, active + 1, rp);
+            alone = mActiveByProcess.size() - active;
+        }
+        startJobs(mPendingJobs[IndexerJob::InteractiveLane], alone + other + std::max(1, reserved), rp);
+        return;
+    }
+    for (int lane=0; lane<IndexerJob::LaneCount; ++lane) {
+        const int max = lane == IndexerJob::InteractiveLane ? limit : limit - reserved;
+        if (!startJobs(mPendingJobs[lane], max, rp))
+            break;
+    }
+}
+
+
+std::shared_ptr<JobScheduler::Node> JobScheduler::indexingNode(Process *process, const Batch &batch) const
+{
+    const uint64_t jobId = mIndexing.value(process).jobId;
+    for (const auto &node : batch) {
+        if (node->job->id == jobId)
+            return node;
+    }
+    return std::shared_ptr<Node>();
+}
+
+static inline bool isBatchable(const std::shared_ptr<IndexerJob> &job)
+{
+    // interactive jobs shouldn't wait for someone else's translation unit and
+    // jobs that have crashed shouldn't take others down with them
+    return (job->lane != IndexerJob::InteractiveLane && job->unsavedFiles.isEmpty()
+            && !(job->flags & IndexerJob::RunAlone) && !job->crashCount);
+}
+
+static inline bool canBatch(const std::shared_ptr<IndexerJob> &job, const std::shared_ptr<IndexerJob> &other)
+{
+    return (job->project == other->project
+            && job->source.compilerId == other->source.compilerId
+            && job->source.language == other->source.language
+            && job->source.includePathHash == other->source.includePathHash
+            && job->source.defines == other->source.defines
+            && job->sourceFile.parentDir() == other->sourceFile.parentDir());
+}
+
+// rp exits with OutOfMemoryExitCode when an allocation fails or it crashes
+// close to --rp-memory-limit. libclang's own handler prints "LLVM ERROR: out
+// of memory" and exits, and the kernel's OOM killer sends a SIGKILL rp can't
+// catch.
+bool JobScheduler::isOutOfMemory(Process *process, const Indexing &indexing, const String &output) const
+{
+    if (process->returnCode() == RTags::OutOfMemoryExitCode
+        || output.contains("out of memory")
+        || output.contains("std::bad_alloc")) {
+        return true;
+    }
+    // rp handles the signals it can, so this is a kill
+    if (process->returnCode() >= 0)
+        return false;
+    const uint64_t limit = static_cast<uint64_t>(Server::instance()->options().rpMemoryLimit) * 1024 * 1024;
+    if (limit && indexing.peakMemory >= limit / 10 * 9)
+        return true;
+    return indexing.memoryPressure;
+}
+
+bool JobScheduler::startJobs(PendingJobs &pending, int max, Path &rp)
+{
+    const auto &options = Server::instance()->options();
+    const int limit = jobLimit();
+    auto it = pending.begin();
+    while (it != pending.end()) {
+        if (mActiveByProcess.size() >= limit)
+            return false;
+        if (mActiveByProcess.size() >= max)
+            break;
+        const std::shared_ptr<Node> node = *it;
+        auto cont = [&it, &pending]() {
+            it = pending.erase(it);
+        };
         assert(node);
         assert(node->job);
         assert(!(node->job->flags & (IndexerJob::Running|IndexerJob::Complete|IndexerJob::Crashed|IndexerJob::Aborted)));
@@ -123,7 +344,7 @@ void JobScheduler::startJobs()
                 //         << mHeaderErrorMaxJobs << mHeaderErrorJobIds;
                 if (options.headerErrorJobCount <= mHeaderErrorJobIds.size()) {
                     warning() << "Holding off on" << node->job->sourceFile << "it's got a header error from" << Location::path(headerError);
-                    node = node->next;
+                    ++it;
                     continue;
                 }
             }
@@ -135,78 +356,133 @@ void JobScheduler::startJobs()
         List<String> arguments;
         for (int i=logLevel().toInt(); i>0; --i)
             arguments << "-v";
+        if (options.rpMemoryLimit > 0 && !(node->job->flags & IndexerJob::RunAlone))
+            arguments << "--memory-limit" << String::number(options.rpMemoryLimit);
 
         process->readyReadStdOut().connect([this](Process *proc) {
-                std::shared_ptr<Node> node = mActiveByProcess[proc];
-                assert(node);
-                node->stdOut.append(proc->readAllStdOut());
+                Indexing &indexing = mIndexing[proc];
+                indexing.stdOut.append(proc->readAllStdOut());
 
-                std::regex rx("@CRASH@([^@]*)@CRASH@");
+                std::regex rx("@(CRASH|JOB)@([^@]*)@\\1@");
                 std::smatch match;
-                while (std::regex_search(node->stdOut.ref(), match, rx)) {
-                    error() << match[1].str();
-                    node->stdOut.remove(match.position(), match.length());
+                while (std::regex_search(indexing.stdOut.ref(), match, rx)) {
+                    if (match[1].str() == "JOB") {
+                        indexing.jobId = strtoull(match[2].str().c_str(), 0, 10);
+                    } else {
+                        error() << match[2].str();
+                    }
+                    indexing.stdOut.remove(match.position(), match.length());
                 }
             });
 
         if (!process->start(rp, arguments)) {
             error() << "Couldn't start rp" << rp << process->errorString();
             delete process;
+            cont();
+            mInactiveById.remove(jobId);
             node->job->flags |= IndexerJob::Crashed;
             debug() << "job crashed (didn't start)" << jobId << node->job->source.key() << node->job.get();
             std::shared_ptr<IndexDataMessage> msg(new IndexDataMessage(node->job));
             msg->setFlag(IndexDataMessage::ParseFailure);
             jobFinished(node->job, msg);
             rp.clear(); // in case rp was missing for a moment and we fell back to searching $PATH
-            cont();
+            // jobFinished() can add and start jobs
+            it = pending.begin();
             continue;
         }
         if (headerError) {
-            node->job->priority = IndexerJob::HeaderError;
             warning() << "Letting" << node->job->sourceFile << "go even with a headerheader error from" << Location::path(headerError);
             mHeaderErrorJobIds.insert(jobId);
         }
-        process->finished().connect([this, jobId](Process *proc) {
+
+        // Hand compatible jobs from the same directory to the same rp so
+        // they're indexed without starting a new process for each of them.
+        // Only as many as it takes to spread the pending jobs over the free
+        // slots, while there are idle slots every job gets its own rp.
+        Batch batch;
+        batch.append(node);
+        const int freeSlots = std::max(1, std::min(limit, max) - static_cast<int>(mActiveByProcess.size()));
+        const int pendingCount = pending.size();
+        const int batchSize = std::min(options.rpBatchSize, (pendingCount + freeSlots - 1) / freeSlots);
+        if (batchSize > 1 && isBatchable(node->job)) {
+            auto candidate = std::next(it);
+            for (int scanned = 0; candidate != pending.end() && batch.size() < batchSize
+                     && scanned < MaxBatchScan; ++scanned) {
+                const std::shared_ptr<Node> other = *candidate;
+                if (isBatchable(other->job) && canBatch(node->job, other->job)
+                    && (mHeaderErrors.isEmpty() || !hasHeaderError(other->job->source.fileId, project))) {
+                    batch.append(other);
+                    candidate = pending.erase(candidate);
+                } else {
+                    ++candidate;
+                }
+            }
+        }
+
+        process->finished().connect([this](Process *proc) {
                 EventLoop::deleteLater(proc);
-                auto node = mActiveByProcess.take(proc);
-                assert(!node || node->process == proc);
+                const Batch batch = mActiveByProcess.take(proc);
+                // a crash is only charged to the job rp said it was on, if
+                // that one was aborted the rest of the batch is just retried
+                const std::shared_ptr<Node> current = indexingNode(proc, batch);
                 const String stdErr = proc->readAllStdErr();
-                if ((node && !node->stdOut.isEmpty()) || !stdErr.isEmpty()) {
-                    error() << (node ? ("Output from " + node->job->sourceFile + ":") : String("Orphaned process:"))
-                            << '\n' << stdErr << (node ? node->stdOut : String());
+                const Indexing indexing = mIndexing.take(proc);
+                const String &stdOut = indexing.stdOut;
+                if (!stdOut.isEmpty() || !stdErr.isEmpty()) {
+                    error() << (current ? ("Output from " + current->job->sourceFile + ":") : String("Orphaned process:"))
+                            << '\n' << stdErr << stdOut;
                 }
 
-                if (node) {
+                const bool failed = proc->returnCode() != 0;
+                for (const auto &node : batch) {
                     assert(node->process == proc);
                     node->process = 0;
                     assert(!(node->job->flags & IndexerJob::Aborted));
-                    if (!(node->job->flags & IndexerJob::Complete) && proc->returnCode() != 0) {
-                        auto nodeById = mActiveById.take(jobId);
-                        assert(nodeById);
-                        assert(nodeById == node);
-                        // job failed, probably no IndexDataMessage coming
-                        node->job->flags |= IndexerJob::Crashed;
-                        debug() << "job crashed" << jobId << node->job->source.key() << node->job.get();
-                        std::shared_ptr<IndexDataMessage> msg(new IndexDataMessage(node->job));
-                        msg->setFlag(IndexDataMessage::ParseFailure);
-                        jobFinished(node->job, msg);
+                    mHeaderErrorJobIds.remove(node->job->id);
+                    if (!failed || node->job->flags & IndexerJob::Complete)
+                        continue;
+                    auto nodeById = mActiveById.take(node->job->id);
+                    assert(nodeById);
+                    assert(nodeById == node);
+                    if (node != current) {
+                        // rp never got to this one
+                        node->job->flags &= ~IndexerJob::Running;
+                        add(node->job);
+                        continue;
                     }
+                    // job failed, probably no IndexDataMessage coming
+                    node->job->flags |= IndexerJob::Crashed;
+                    if (isOutOfMemory(proc, indexing, stdErr + stdOut))
+                        node->job->flags |= IndexerJob::OutOfMemory;
+                    debug() << "job crashed" << node->job->id << node->job->source.key() << node->job.get();
+                    std::shared_ptr<IndexDataMessage> msg(new IndexDataMessage(node->job));
+                    msg->setFlag(IndexDataMessage::ParseFailure);
+                    jobFinished(node->job, msg);
                 }
-                mHeaderErrorJobIds.remove(jobId);
                 startJobs();
             });
 
-
-        node->process = process;
-        assert(!(node->job->flags & ~IndexerJob::Type_Mask));
-        node->job->flags |= IndexerJob::Running;
-        process->write(node->job->encode());
-        mActiveByProcess[process] = node;
-        // error() << "STARTING JOB" << node->job->source.sourceFile();
-        mInactiveById.remove(jobId);
-        mActiveById[jobId] = node;
+        const uint64_t now = Rct::currentTimeMs();
+        for (const auto &batched : batch) {
+            batched->process = process;
+            batched->started = now;
+            assert(!(batched->job->flags & ~IndexerJob::Type_Mask));
+            batched->job->flags |= IndexerJob::Running;
+            process->write(batched->job->encode());
+            // error() << "STARTING JOB" << batched->job->source.sourceFile();
+            mInactiveById.remove(batched->job->id);
+            mActiveById[batched->job->id] = batched;
+        }
+        // no more jobs for this rp
+        process->write(String(sizeof(uint32_t), '\0'));
+        mActiveByProcess[process] = batch;
+        mIndexing[process].jobId = batch.first()->job->id;
         cont();
+        // only now that it's out of the pending set
+        if (headerError)
+            node->job->priority = IndexerJob::HeaderError;
     }
+    return true;
 }
 
 void JobScheduler::handleIndexDataMessage(const std::shared_ptr<IndexDataMessage> &message)
@@ -240,46 +516,98 @@ void JobScheduler::jobFinished(const std::shared_ptr<IndexerJob> &job, const std
     job->flags &= ~IndexerJob::Running;
     if (!(job->flags & IndexerJob::Crashed)) {
         job->flags |= IndexerJob::Complete;
+        if (message->cost().duration) {
+            mFinishedDuration += message->cost().duration;
+            ++mFinishedCount;
+        }
     } else {
-        ++job->crashCount;
-        const auto &options = Server::instance()->options();
-        assert(job->crashCount <= options.maxCrashCount);
-        if (job->crashCount < options.maxCrashCount) {
+        auto retry = [job, this, &project]() {
             project->releaseFileIds(job->visited);
             EventLoop::eventLoop()->registerTimer([job, this](int) {
                     if (!(job->flags & IndexerJob::Aborted)) {
                         job->flags &= ~IndexerJob::Crashed;
+                        job->flags &= ~IndexerJob::OutOfMemory;
                         job->acquireId();
                         add(job);
                     }
                 }, 500, Timer::SingleShot); // give it 500 ms before we try again
+        };
+        if ((job->flags & (IndexerJob::OutOfMemory|IndexerJob::RunAlone)) == IndexerJob::OutOfMemory) {
+            // not a crash as such, try it again once with the machine to itself
+            error() << job->sourceFile << "ran out of memory, retrying without other jobs running";
+            job->flags |= IndexerJob::RunAlone;
+            retry();
+            return;
+        }
+        ++job->crashCount;
+        const auto &options = Server::instance()->options();
+        assert(job->crashCount <= options.maxCrashCount);
+        if (job->crashCount < options.maxCrashCount && !(job->flags & IndexerJob::OutOfMemory)) {
+            retry();
             return;
         }
-        debug() << "job crashed too many times" << job->id << job->source.key() << job.get();
+        if (job->flags & IndexerJob::OutOfMemory) {
+            error() << job->sourceFile << "ran out of memory even when running alone, giving up";
+        } else {
+            debug() << "job crashed too many times" << job->id << job->source.key() << job.get();
+        }
     }
     project->onJobFinished(job, message);
 }
 
 void JobScheduler::dump(const std::shared_ptr<Connection> &conn)
 {
-    if (!mPendingJobs.isEmpty()) {
-        conn->write("Pending:");
-        for (const auto &node : mPendingJobs) {
-            conn->write<128>("%s: %s %s",
+    const auto &options = Server::instance()->options();
+    if (options.minJobCount < options.jobCount) {
+        conn->write<256>("Concurrency: %d (min %d, max %d) %s. MemAvailable: %lluMB/%lluMB, load: %.2f, rp RSS: %lluMB in %d processes",
+                         jobLimit(), options.minJobCount, options.jobCount, mJobLimitReason.constData(),
+                         static_cast<unsigned long long>(mLoad.memAvailable / (1024 * 1024)),
+                         static_cast<unsigned long long>(mLoad.memTotal / (1024 * 1024)),
+                         mLoad.loadAverage,
+                         static_cast<unsigned long long>(mLoad.rpMemory / (1024 * 1024)),
+                         mLoad.rpCount);
+    } else {
+        conn->write<64>("Concurrency: %d", options.jobCount);
+    }
+    for (int lane=0; lane<IndexerJob::LaneCount; ++lane) {
+        if (mPendingJobs[lane].empty())
+            continue;
+        conn->write<64>("Pending (%s):", IndexerJob::laneName(static_cast<IndexerJob::Lane>(lane)));
+        for (const auto &node : mPendingJobs[lane]) {
+            conn->write<128>("%s: %s %s priority %d estimate %ums",
                              node->job->sourceFile.constData(),
                              node->job->flags.toString().constData(),
-                             IndexerJob::dumpFlags(node->job->flags).constData());
+                             IndexerJob::dumpFlags(node->job->flags).constData(),
+                             node->job->priority, node->estimate);
+        }
+    }
+    if (!mRunAlone.empty()) {
+        conn->write("Pending (run alone):");
+        for (const auto &node : mRunAlone) {
+            conn->write<128>("%s: %s %s priority %d estimate %ums",
+                             node->job->sourceFile.constData(),
+                             node->job->flags.toString().constData(),
+                             IndexerJob::dumpFlags(node->job->flags).constData(),
+                             node->job->priority, node->estimate);
         }
     }
     if (!mActiveById.isEmpty()) {
         conn->write("Active:");
+        const uint64_t now = Rct::currentTimeMs();
         for (const auto &node : mActiveById) {
-            conn->write<128>("%s: %s %s",
+            conn->write<128>("%s: %s %s running %llums estimate %ums",
                              node.second->job->sourceFile.constData(),
                              node.second->job->flags.toString().constData(),
-                             IndexerJob::dumpFlags(node.second->job->flags).constData());
+                             IndexerJob::dumpFlags(node.second->job->flags).constData(),
+                             static_cast<unsigned long long>(now - node.second->started),
+                             node.second->estimate);
         }
     }
+    if (!mActiveById.isEmpty() || !mPendingJobs[IndexerJob::InteractiveLane].empty()
+        || !mPendingJobs[IndexerJob::DirtyLane].empty() || !mPendingJobs[IndexerJob::BulkLane].empty()
+        || !mRunAlone.empty()) {
+        conn->write<64>("ETA: %llus", static_cast<unsigned long long>(eta() / 1000));
+    }
 
     if (!mHeaderErrorJobIds.isEmpty()) {
         conn->write("HeaderErrorJobs:");
@@ -305,11 +633,18 @@ void JobScheduler::abort(const std::shared_ptr<IndexerJob> &job)
         debug() << "Aborting inactive job" << job->source.sourceFile() << job->source.key() << job->id << job.get();
         node = mInactiveById.take(job->id);
         assert(node);
-        mPendingJobs.remove(node);
+        pendingJobs(job).erase(node);
     } else {
         debug() << "Aborting active job" << job->source.sourceFile() << job->source.key() << job->id << job.get();
     }
     if (node->process) {
+        // the rest of the batch is still wanted, rp's data for this job will be ignored
+        Batch &batch = mActiveByProcess[node->process];
+        batch.remove(node);
+        for (const auto &other : batch) {
+            if (!(other->job->flags & IndexerJob::Complete))
+                return;
+        }
         debug() << "Killing process" << node->process;
         node->process->kill();
         mActiveByProcess.remove(node->process);
@@ -327,22 +662,29 @@ bool JobScheduler::increasePriority(uint32_t fileId)
 {
     warning() << "Looking for" << Location::path(fileId);
 
-    for (auto node = mPendingJobs.first(); node; node = node->next) {
-        if (node->job->source.fileId == fileId) {
-            if (node->job->priority != IndexerJob::HeaderError) {
-                node->job->priority = MaxPriority;
-                mPendingJobs.moveToFront(node);
-                warning() << "Bumped priority for" << Location::path(fileId);
-            }
+    for (int lane=0; lane<IndexerJob::LaneCount; ++lane) {
+        for (const auto &node : mPendingJobs[lane]) {
+            if (node->job->source.fileId == fileId) {
+                if (node->job->priority != IndexerJob::HeaderError) {
+                    const std::shared_ptr<Node> copy = node;
+                    mPendingJobs[lane].erase(copy);
+                    copy->job->priority = MaxPriority;
+                    copy->job->lane = IndexerJob::InteractiveLane;
+                    mPendingJobs[IndexerJob::InteractiveLane].insert(copy);
+                    warning() << "Bumped priority for" << Location::path(fileId);
+                }
 
-            return true;
+                return true;
+            }
         }
     }
 
-    for (auto pair : mActiveByProcess) {
-        if (pair.second->job->source.fileId == fileId) {
-            warning() << Location::path(fileId) << "is already running";
-            return true;
+    for (const auto &pair : mActiveByProcess) {
+        for (const auto &node : pair.second) {
+            if (node->job->source.fileId == fileId) {
+                warning() << Location::path(fileId) << "is already running";
+                return true;
+            }
         }
     }
     warning() << "Failed to find node for" << Location::path(fileId);
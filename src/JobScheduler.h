@@ -19,7 +19,7 @@
 #include "IndexerJob.h"
 #include "IndexDataMessage.h"
 #include <memory>
-#include <rct/EmbeddedLinkedList.h>
+#include <set>
 #include <rct/Connection.h>
 
 class JobScheduler : public std::enable_shared_from_this<JobScheduler>
@@ -53,24 +53,83 @@ public:
     void clearHeaderError(uint32_t file);
     Set<uint32_t> headerErrors() const { return mHeaderErrors; }
     bool increasePriority(uint32_t fileId);
+    // estimated ms until all pending and active jobs are done
+    uint64_t eta() const;
+    // how many rp processes we currently allow, between
+    // Server::Options::minJobCount and Server::Options::jobCount
+    int jobLimit() const;
 private:
+    void updateJobLimit();
+    // polls the load while there are jobs, see updateJobLimit()
+    void startJobLimitTimer();
+    bool isIdle() const;
     enum { HighPriority = 5 };
     void jobFinished(const std::shared_ptr<IndexerJob> &job, const std::shared_ptr<IndexDataMessage> &message);
     void startJobs();
     struct Node {
         std::shared_ptr<IndexerJob> job;
         Process *process;
-        std::shared_ptr<Node> next, prev;
-        String stdOut;
+        uint32_t estimate; // ms, fixed when the job is queued
+        uint64_t started;
+    };
+    // highest priority first, then the longest jobs so the long tail doesn't
+    // end up running on its own, then in the order the jobs were added. A
+    // job's priority must not change while it's queued.
+    struct NodeCompare {
+        bool operator()(const std::shared_ptr<Node> &l, const std::shared_ptr<Node> &r) const
+        {
+            if (l->job->priority != r->job->priority)
+                return l->job->priority > r->job->priority;
+            if (l->estimate != r->estimate)
+                return l->estimate > r->estimate;
+            return l->job->id < r->job->id;
+        }
     };
+    // jobs handed to the same rp, in the order rp indexes them
+    typedef List<std::shared_ptr<Node> > Batch;
+    // the job rp is indexing, null if it has been aborted
+    std::shared_ptr<Node> indexingNode(Process *process, const Batch &batch) const;
+    uint32_t estimate(const std::shared_ptr<IndexerJob> &job) const;
+    typedef std::set<std::shared_ptr<Node>, NodeCompare> PendingJobs;
+    bool startJobs(PendingJobs &pending, int max, Path &rp);
+    PendingJobs &pendingJobs(const std::shared_ptr<IndexerJob> &job)
+    {
+        return job->flags & IndexerJob::RunAlone ? mRunAlone : mPendingJobs[job->lane];
+    }
     uint32_t hasHeaderError(DependencyNode *node, Set<uint32_t> &seen) const;
     uint32_t hasHeaderError(uint32_t file, const std::shared_ptr<Project> &project) const;
 
     int mProcrastination;
+    // for jobs we have no cost history for
+    uint64_t mFinishedDuration;
+    int mFinishedCount;
+
+    // adaptive concurrency, sampled every second by updateJobLimit()
+    struct Load {
+        Load() : memTotal(0), memAvailable(0), loadAverage(0), rpMemory(0), rpCount(0) {}
+        uint64_t memTotal, memAvailable; // bytes
+        double loadAverage;
+        uint64_t rpMemory; // total RSS of the running rps
+        int rpCount;
+    };
+    int mJobLimit, mJobLimitTimer;
+    Load mLoad;
+    String mJobLimitReason;
     Set<uint32_t> mHeaderErrors;
     Set<uint64_t> mHeaderErrorJobIds;
-    EmbeddedLinkedList<std::shared_ptr<Node> > mPendingJobs;
-    Hash<Process *, std::shared_ptr<Node> > mActiveByProcess;
+    PendingJobs mPendingJobs[IndexerJob::LaneCount];
+    // jobs whose rp ran out of memory, these wait for all other rps to finish
+    PendingJobs mRunAlone;
+    Hash<Process *, Batch> mActiveByProcess;
+    struct Indexing {
+        Indexing() : jobId(0), peakMemory(0), memoryPressure(false) {}
+        uint64_t jobId; // rp writes @JOB@<id>@JOB@ when it starts a job
+        String stdOut;
+        uint64_t peakMemory; // VmPeak when updateJobLimit() last looked
+        bool memoryPressure; // whether the machine was short on memory then
+    };
+    bool isOutOfMemory(Process *process, const Indexing &indexing, const String &output) const;
+    Hash<Process *, Indexing> mIndexing;
     Hash<uint64_t, std::shared_ptr<Node> > mActiveById, mInactiveById;
 };
 
@@ -17,10 +17,13 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "Server.h"
 #include <rct/Rct.h>
 #include "RTags.h"
-Hash<Path, uint32_t> Location::sPathsToIds;
-Hash<uint32_t, Path> Location::sIdsToPaths;
-uint32_t Location::sLastId = 0;
 std::mutex Location::sMutex;
+Location::ChunkedTable<Path> Location::sDirs;
+Location::ChunkedTable<Location::FileEntry> Location::sFiles;
+Location::PathShard Location::sPathShards[PathShardCount];
+std::atomic<uint32_t> Location::sLastDirId(0);
+std::atomic<uint32_t> Location::sLastId(0);
+void (*Location::sFileInserted)() = 0;
 static inline uint64_t createMask(int startBit, int bitCount)
 {
     uint64_t mask = 0;
@@ -34,6 +37,181 @@ const uint64_t Location::FILEID_MASK = createMask(0, FileBits);
 const uint64_t Location::LINE_MASK = createMask(FileBits, LineBits);
 const uint64_t Location::COLUMN_MASK = createMask(FileBits + LineBits, ColumnBits);
 
+String Location::fileKey(uint32_t dirId, const char *name, int len)
+{
+    String ret(sizeof(dirId) + len, ' ');
+    memcpy(ret.data(), &dirId, sizeof(dirId));
+    memcpy(ret.data() + sizeof(dirId), name, len);
+    return ret;
+}
+
+uint32_t Location::findDir(const Path &dir)
+{
+    PathShard &shard = pathShard(dir);
+    const std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.dirs.value(dir);
+}
+
+uint32_t Location::insertDir(const Path &dir)
+{
+    PathShard &shard = pathShard(dir);
+    const std::lock_guard<std::mutex> lock(shard.mutex);
+    uint32_t &id = shard.dirs[dir];
+    if (!id) {
+        id = sLastDirId.fetch_add(1) + 1;
+        const std::lock_guard<std::mutex> writeLock(sMutex);
+        sDirs.publish(id, dir);
+    }
+    return id;
+}
+
+bool Location::publish(uint32_t id, uint32_t dirId, const String &name)
+{
+    const FileEntry entry = { dirId, name };
+    const std::lock_guard<std::mutex> lock(sMutex);
+    if (!sFiles.publish(id, entry)) {
+        error("Invalid fileId %u for %s", id, name.constData());
+        return false;
+    }
+    return true;
+}
+
+uint32_t Location::fileId(const Path &path)
+{
+    const int slash = path.lastIndexOf('/');
+    if (slash == -1)
+        return 0;
+    const uint32_t dirId = findDir(path.left(slash + 1));
+    if (!dirId)
+        return 0;
+    const String key = fileKey(dirId, path.constData() + slash + 1, path.size() - slash - 1);
+    PathShard &shard = pathShard(key);
+    const std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.files.value(key);
+}
+
+uint32_t Location::insertFile(const Path &path)
+{
+    assert(path.isAbsolute());
+    assert(!path.contains(".."));
+    // in the case of Source::compilerId path can be a symlink
+    const int slash = path.lastIndexOf('/');
+    const uint32_t dirId = insertDir(path.left(slash + 1));
+    const String name = path.mid(slash + 1);
+    const String key = fileKey(dirId, name.constData(), name.size());
+    uint32_t ret;
+    {
+        PathShard &shard = pathShard(key);
+        const std::lock_guard<std::mutex> lock(shard.mutex);
+        uint32_t &id = shard.files[key];
+        if (id)
+            return id;
+        ret = id = sLastId.fetch_add(1) + 1;
+        publish(ret, dirId, name);
+    }
+    if (sFileInserted)
+        sFileInserted();
+    return ret;
+}
+
+void Location::set(const Path &path, uint32_t fileId)
+{
+    const int slash = path.lastIndexOf('/');
+    const uint32_t dirId = insertDir(path.left(slash + 1));
+    const String name = path.mid(slash + 1);
+    const String key = fileKey(dirId, name.constData(), name.size());
+    {
+        PathShard &shard = pathShard(key);
+        const std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.files[key] = fileId;
+    }
+    if (fileId && publish(fileId, dirId, name))
+        updateLastId(fileId);
+}
+
+void Location::updateLastId(uint32_t id)
+{
+    uint32_t last = sLastId.load(std::memory_order_relaxed);
+    while (last < id && !sLastId.compare_exchange_weak(last, id)) {}
+}
+
+void Location::clear()
+{
+    for (int i=0; i<PathShardCount; ++i) {
+        const std::lock_guard<std::mutex> lock(sPathShards[i].mutex);
+        sPathShards[i].dirs.clear();
+        sPathShards[i].files.clear();
+    }
+    const std::lock_guard<std::mutex> lock(sMutex);
+    sFiles.clear();
+    sDirs.clear();
+    sLastDirId.store(0);
+    sLastId.store(0);
+}
+
+Hash<uint32_t, Path> Location::idsToPaths()
+{
+    Hash<uint32_t, Path> ret;
+    const uint32_t last = lastId();
+    for (uint32_t id=1; id<=last; ++id) {
+        Path p = path(id);
+        if (!p.isEmpty())
+            ret[id] = std::move(p);
+    }
+    return ret;
+}
+
+void Location::init(const Hash<uint32_t, Path> &idsToPaths)
+{
+    clear();
+    for (const auto &it : idsToPaths)
+        set(it.second, it.first);
+}
+
+void Location::encodeFileIds(Serializer &serializer)
+{
+    // Hold every shard so no files or directories can be added while we
+    // write. Writers never hold more than one shard at a time.
+    uint32_t fileCount = 0;
+    for (int i=0; i<PathShardCount; ++i) {
+        sPathShards[i].mutex.lock();
+        fileCount += sPathShards[i].files.size();
+    }
+
+    Hash<uint32_t, Path> dirs;
+    const uint32_t lastDirId = sLastDirId.load();
+    for (uint32_t id=1; id<=lastDirId; ++id) {
+        if (const Path *dir = sDirs.find(id))
+            dirs[id] = *dir;
+    }
+    serializer << dirs << fileCount;
+    for (int i=0; i<PathShardCount; ++i) {
+        for (const auto &it : sPathShards[i].files) {
+            uint32_t dirId;
+            memcpy(&dirId, it.first.constData(), sizeof(dirId));
+            serializer << dirId << it.first.mid(sizeof(dirId)) << it.second;
+        }
+    }
+    for (int i=0; i<PathShardCount; ++i)
+        sPathShards[i].mutex.unlock();
+}
+
+void Location::decodeFileIds(Deserializer &deserializer)
+{
+    clear();
+    Hash<uint32_t, Path> dirs;
+    uint32_t fileCount;
+    deserializer >> dirs >> fileCount;
+    for (uint32_t i=0; i<fileCount; ++i) {
+        uint32_t dirId, fileId;
+        String name;
+        deserializer >> dirId >> name >> fileId;
+        Path path = dirs.value(dirId);
+        path += name;
+        set(path, fileId);
+    }
+}
+
 String Location::key(Flags<KeyFlag> flags) const
 {
     if (isNull())
@@ -27,12 +27,8 @@
 #if defined(OS_Linux)
 #include <linux/limits.h>
 #endif
-#ifndef RTAGS_SINGLE_THREAD
+#include <atomic>
 #include <mutex>
-#define LOCK() const std::lock_guard<std::mutex> lock(sMutex)
-#else
-#define LOCK() do {} while (0)
-#endif
 
 static inline int intCompare(uint32_t l, uint32_t r)
 {
@@ -63,49 +59,27 @@ public:
     {
     }
 
-    static inline uint32_t fileId(const Path &path)
-    {
-        LOCK();
-        return sPathsToIds.value(path);
-    }
+    static uint32_t fileId(const Path &path);
     static inline Path path(uint32_t id)
     {
-        LOCK();
-        return sIdsToPaths.value(id);
+        const FileEntry *file = sFiles.find(id);
+        if (!file)
+            return Path();
+        const Path *dir = sDirs.find(file->dirId);
+        assert(dir);
+        Path ret = *dir;
+        ret += file->name;
+        return ret;
     }
 
     static uint32_t lastId()
     {
-        LOCK();
-        return sLastId;
+        return sLastId.load(std::memory_order_acquire);
     }
 
-    static inline uint32_t insertFile(const Path &path)
-    {
-        bool save = false;
-        (void)save;
-        assert(path.isAbsolute());
-        assert(!path.contains(".."));
-        // in the case of Source::compilerId path can be a symlink
-        uint32_t ret;
-        {
-            LOCK();
-            uint32_t &id = sPathsToIds[path];
-            if (!id) {
-                id = ++sLastId;
-                sIdsToPaths[id] = path;
-                save = true;
-            }
-            ret = id;
-        }
-#ifndef RTAGS_SINGLE_THREAD
-        extern void saveFileIds();
-        if (save)
-            saveFileIds();
-#endif
-
-        return ret;
-    }
+    static uint32_t insertFile(const Path &path);
+    // called after insertFile() adds a file, rdm saves its fileids here
+    static void setFileInsertedCallback(void (*callback)()) { sFileInserted = callback; }
 
     inline uint32_t fileId() const { return static_cast<uint32_t>(value & FILEID_MASK); }
     inline uint32_t line() const { return static_cast<uint32_t>((value & LINE_MASK) >> FileBits); }
@@ -113,10 +87,8 @@ public:
 
     inline Path path() const
     {
-        if (mCachedPath.isEmpty()) {
-            LOCK();
-            mCachedPath = sIdsToPaths.value(fileId());
-        }
+        if (mCachedPath.isEmpty())
+            mCachedPath = path(fileId());
         return mCachedPath;
     }
     inline bool isNull() const { return !value; }
@@ -217,60 +189,120 @@ public:
             return Location();
         return Location(fileId, line, col);
     }
-    static Hash<uint32_t, Path> idsToPaths()
-    {
-        LOCK();
-        return sIdsToPaths;
-    }
-    static Hash<Path, uint32_t> pathsToIds()
-    {
-        LOCK();
-        return sPathsToIds;
-    }
-    static void init(const Hash<Path, uint32_t> &pathsToIds)
-    {
-        LOCK();
-        sPathsToIds = pathsToIds;
-        sIdsToPaths.clear();
-        sLastId = 0;
-        for (const auto &it : sPathsToIds) {
-            sIdsToPaths[it.second] = it.first;
-            sLastId = std::max(sLastId, it.second);
-        }
-    }
-
-    static void init(const Hash<uint32_t, Path> &idsToPaths)
-    {
-        LOCK();
-        sIdsToPaths = idsToPaths;
-        sPathsToIds.clear();
-        sLastId = 0;
-        for (const auto &it : sIdsToPaths) {
-            sPathsToIds[it.second] = it.first;
-            sLastId = std::max(sLastId, it.first);
-        }
-    }
-
-    static void set(const Path &path, uint32_t fileId)
-    {
-        LOCK();
-        sPathsToIds[path] = fileId;
-        Path &p = sIdsToPaths[fileId];
-        if (p.isEmpty())
-            p = path;
-        sLastId = std::max(sLastId, fileId);
-    }
+    static Hash<uint32_t, Path> idsToPaths();
+    // init() and decodeFileIds() replace the whole table and must not race
+    // with readers
+    static void init(const Hash<uint32_t, Path> &idsToPaths);
+    static void set(const Path &path, uint32_t fileId);
+    static void encodeFileIds(Serializer &serializer);
+    static void decodeFileIds(Deserializer &deserializer);
 private:
-    static std::mutex sMutex;
-    static Hash<Path, uint32_t> sPathsToIds;
-    static Hash<uint32_t, Path> sIdsToPaths;
-    static uint32_t sLastId;
     mutable Path mCachedPath;
     enum {
         FileBits = 22,
         LineBits = 21,
         ColumnBits = 64 - FileBits - LineBits
     };
+
+    // Paths are stored as an interned directory plus a file name. Both the
+    // directories and the files live in append-only tables of fixed size
+    // chunks indexed by id. A slot is written once, under sMutex, and then
+    // published through its flag so readers never need a lock. The reverse
+    // lookups are split over a number of independently locked shards.
+    enum {
+        ChunkBits = 12,
+        ChunkSize = 1 << ChunkBits,
+        ChunkCount = (1 << FileBits) >> ChunkBits,
+        PathShardCount = 16
+    };
+    template <typename T>
+    struct ChunkedTable {
+        struct Chunk {
+            Chunk()
+            {
+                for (int i=0; i<ChunkSize; ++i)
+                    published[i].store(false, std::memory_order_relaxed);
+            }
+            T values[ChunkSize];
+            std::atomic<bool> published[ChunkSize];
+        };
+
+        inline const T *find(uint32_t id) const
+        {
+            if (!id || id >= (1u << FileBits))
+                return 0;
+            const Chunk *chunk = chunks[id >> ChunkBits].load(std::memory_order_acquire);
+            if (!chunk)
+                return 0;
+            const uint32_t idx = id & (ChunkSize - 1);
+            if (!chunk->published[idx].load(std::memory_order_acquire))
+                return 0;
+            return &chunk->values[idx];
+        }
+
+        // must be called with sMutex held
+        bool publish(uint32_t id, const T &value)
+        {
+            if (!id || id >= (1u << FileBits))
+                return false;
+            std::atomic<Chunk*> &slot = chunks[id >> ChunkBits];
+            Chunk *chunk = slot.load(std::memory_order_relaxed);
+            if (!chunk) {
+                chunk = new Chunk;
+                slot.store(chunk, std::memory_order_release);
+            }
+            const uint32_t idx = id & (ChunkSize - 1);
+            if (!chunk->published[idx].load(std::memory_order_relaxed)) {
+                chunk->values[idx] = value;
+                chunk->published[idx].store(true, std::memory_order_release);
+            }
+            return true;
+        }
+
+        void clear()
+        {
+            for (int i=0; i<ChunkCount; ++i)
+                delete chunks[i].exchange(0);
+        }
+
+        std::atomic<Chunk*> chunks[ChunkCount];
+    };
+    struct FileEntry {
+        uint32_t dirId;
+        String name;
+    };
+    struct PathShard {
+        std::mutex mutex;
+        Hash<Path, uint32_t> dirs; // directory -> dirId
+        Hash<String, uint32_t> files; // fileKey(dirId, name) -> fileId
+    };
+
+    static inline PathShard &pathShard(const String &key)
+    {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        const char *ch = key.constData();
+        const char *end = ch + key.size();
+        while (ch != end) {
+            hash ^= static_cast<unsigned char>(*ch++);
+            hash *= 16777619u;
+        }
+        return sPathShards[hash % PathShardCount];
+    }
+    static String fileKey(uint32_t dirId, const char *name, int len);
+    static uint32_t findDir(const Path &dir);
+    static uint32_t insertDir(const Path &dir);
+    static bool publish(uint32_t id, uint32_t dirId, const String &name);
+    static void updateLastId(uint32_t id);
+    static void clear();
+
+    static std::mutex sMutex;
+    static ChunkedTable<Path> sDirs;
+    static ChunkedTable<FileEntry> sFiles;
+    static PathShard sPathShards[PathShardCount];
+    static std::atomic<uint32_t> sLastDirId;
+    static std::atomic<uint32_t> sLastId;
+    static void (*sFileInserted)();
     static const uint64_t FILEID_MASK;
     static const uint64_t LINE_MASK;
     static const uint64_t COLUMN_MASK;
@@ -0,0 +1,345 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "PchManager.h"
+#include "PchThread.h"
+#include "RTags.h"
+#include "RTagsClang.h"
+#include <rct/DataFile.h>
+#include <rct/EventLoop.h>
+#include <rct/Log.h>
+#include <rct/Rct.h>
+#include <algorithm>
+#include <stdio.h>
+#include <unistd.h>
+
+enum {
+    MinPchIncludes = 5, // a shorter prefix isn't worth a pch
+    MinPchSources = 3, // how many sources have to start with the prefix
+    EvaluateDelay = 5000
+};
+
+// rp has no server options so it doesn't add the defaults again
+static const Flags<Source::CommandLineFlag> commandLineFlags = (Source::Default
+                                                                |Source::ExcludeDefaultArguments
+                                                                |Source::ExcludeDefaultDefines
+                                                                |Source::ExcludeDefaultIncludePaths);
+
+static inline const char *headerLanguage(Source::Language language)
+{
+    switch (language) {
+    case Source::C:
+    case Source::CHeader:
+        return "c-header";
+    case Source::CPlusPlus:
+    case Source::CPlusPlus11:
+    case Source::CPlusPlusHeader:
+    case Source::CPlusPlus11Header:
+        return "c++-header";
+    case Source::ObjectiveC:
+        return "objective-c-header";
+    case Source::ObjectiveCPlusPlus:
+        return "objective-c++-header";
+    case Source::NoLanguage:
+        break;
+    }
+    return 0;
+}
+
+static inline String clangVersion()
+{
+    return RTags::eatString(clang_getClangVersion());
+}
+
+// Each pch has a .deps file next to it with the clang version it was built
+// with and the files that went into it. A pch is only used while it's newer
+// than all of them.
+static bool readDependencies(const Path &pch, Set<Path> &files)
+{
+    DataFile file(pch + ".deps", RTags::DatabaseVersion);
+    if (!file.open(DataFile::Read))
+        return false;
+    String version;
+    file.deserializer() >> version >> files;
+    if (version != clangVersion())
+        return false;
+    const uint64_t built = pch.lastModifiedMs();
+    if (!built)
+        return false;
+    for (const Path &dep : files) {
+        const uint64_t lastModified = dep.lastModifiedMs();
+        if (!lastModified || lastModified > built)
+            return false;
+    }
+    return true;
+}
+
+static bool writeDependencies(const Path &pch, const Set<Path> &files)
+{
+    DataFile file(pch + ".deps", RTags::DatabaseVersion);
+    if (!file.open(DataFile::Write))
+        return false;
+    file.serializer() << clangVersion() << files;
+    return file.flush();
+}
+
+static void removePch(const Path &pch)
+{
+    unlink(pch.constData());
+    unlink((pch + ".deps").constData());
+}
+
+PchManager::PchManager(const Path &dir)
+    : mDir(dir), mBuilds(0), mTimer(-1)
+{
+    // pchs are kept across restarts, only the ones that are out of date or
+    // were never finished are removed
+    const List<Path> existing = mDir.files(Path::File);
+    for (const Path &file : existing) {
+        Set<Path> files;
+        if (file.endsWith(".pch") && !readDependencies(file, files)) {
+            warning() << "Removing stale pch" << file;
+            removePch(file);
+        }
+    }
+    for (const Path &file : existing) {
+        if (file.endsWith(".pch"))
+            continue;
+        Path pch;
+        if (file.endsWith(".deps")) {
+            pch = file.left(file.size() - 5);
+        } else if (file.endsWith(".h")) {
+            pch = file.left(file.size() - 2) + ".pch";
+        }
+        if (pch.isEmpty() || !pch.isFile())
+            unlink(file.constData()); // orphaned header or .deps, or a build that never finished
+    }
+}
+
+PchManager::~PchManager()
+{
+    if (mTimer != -1) {
+        if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop())
+            loop->unregisterTimer(mTimer);
+    }
+}
+
+uint64_t PchManager::groupKey(const Source &source)
+{
+    String data = String::join(source.toCommandLine(commandLineFlags), ' ');
+    data += Source::languageName(source.language);
+    return RTags::contentHash(data);
+}
+
+Path PchManager::pch(const Source &source) const
+{
+    const auto entry = mSources.find(source.key());
+    if (entry == mSources.end())
+        return Path();
+    const auto group = mGroups.find(entry->second.group);
+    if (group == mGroups.end() || group->second.state != Group::Ready)
+        return Path();
+
+    // the pch stands in for the includes the main file starts with, nothing else
+    const List<uint32_t> &leading = entry->second.leadingIncludes;
+    const List<uint32_t> &prefix = group->second.prefix;
+    if (leading.size() < prefix.size() || !std::equal(prefix.begin(), prefix.end(), leading.begin()))
+        return Path();
+    if (groupKey(source) != entry->second.group) // arguments changed
+        return Path();
+    return group->second.pch;
+}
+
+void PchManager::update(const Source &source, const List<uint32_t> &leadingIncludes)
+{
+    const uint64_t key = groupKey(source);
+    Entry &entry = mSources[source.key()];
+    if (entry.group == key && entry.leadingIncludes == leadingIncludes)
+        return;
+    entry.group = key;
+    entry.leadingIncludes = leadingIncludes;
+    if (leadingIncludes.size() < MinPchIncludes)
+        return;
+
+    Group &group = mGroups[key];
+    if (group.source.isNull())
+        group.source = source;
+    if (group.state == Group::None) {
+        group.dirty = true;
+        startTimer();
+    }
+}
+
+void PchManager::remove(uint64_t key)
+{
+    mSources.remove(key);
+}
+
+void PchManager::onFileModified(uint32_t fileId)
+{
+    for (auto &it : mGroups) {
+        Group &group = it.second;
+        if (group.state == Group::None || (!group.dependencies.contains(fileId) && !group.prefix.contains(fileId)))
+            continue;
+        if (group.state != Group::Building)
+            removePch(group.pch);
+        warning() << Location::path(fileId) << "was modified, dropping pch" << group.pch;
+        group.state = Group::None;
+        group.dependencies.clear();
+        group.pch.clear();
+        group.dirty = true;
+        startTimer();
+    }
+}
+
+void PchManager::startTimer()
+{
+    if (mTimer != -1)
+        return;
+    std::weak_ptr<PchManager> weak = shared_from_this();
+    mTimer = EventLoop::eventLoop()->registerTimer([weak](int) {
+            if (std::shared_ptr<PchManager> manager = weak.lock()) {
+                manager->mTimer = -1;
+                manager->evaluate();
+            }
+        }, EvaluateDelay, Timer::SingleShot);
+}
+
+void PchManager::evaluate()
+{
+    Hash<uint64_t, List<const List<uint32_t> *> > members;
+    for (const auto &entry : mSources) {
+        const auto group = mGroups.find(entry.second.group);
+        if (group != mGroups.end() && group->second.dirty && group->second.state == Group::None)
+            members[entry.second.group].append(&entry.second.leadingIncludes);
+    }
+
+    for (const auto &it : members) {
+        Group &group = mGroups[it.first];
+        group.dirty = false;
+
+        // count the sources starting with each prefix, keyed on a hash of the prefix
+        struct Count {
+            Count() : count(0), length(0), includes(0) {}
+            int count, length;
+            const List<uint32_t> *includes;
+        };
+        Hash<uint64_t, Count> counts;
+        for (const List<uint32_t> *includes : it.second) {
+            uint64_t hash = 14695981039346656037ull;
+            for (int i=0; i<includes->size(); ++i) {
+                hash = (hash ^ includes->at(i)) * 1099511628211ull;
+                if (i + 1 < MinPchIncludes)
+                    continue;
+                Count &count = counts[hash];
+                ++count.count;
+                count.length = i + 1;
+                count.includes = includes;
+            }
+        }
+        const Count *best = 0;
+        for (const auto &count : counts) {
+            if (count.second.count >= MinPchSources
+                && (!best || count.second.count * count.second.length > best->count * best->length)) {
+                best = &count.second;
+            }
+        }
+        if (best) {
+            group.prefix = best->includes->mid(0, best->length);
+            build(it.first);
+        }
+    }
+}
+
+void PchManager::build(uint64_t key)
+{
+    Group &group = mGroups[key];
+    const char *language = headerLanguage(group.source.language);
+    if (!language) {
+        group.state = Group::Failed;
+        return;
+    }
+    // named after what's in it so it can be found again after a restart
+    String data(reinterpret_cast<const char *>(&key), sizeof(key));
+    data.append(reinterpret_cast<const char *>(group.prefix.data()), group.prefix.size() * sizeof(uint32_t));
+    const String name = String::format<64>("%016llx", static_cast<unsigned long long>(RTags::contentHash(data)));
+    const Path output = mDir + name + ".pch";
+    Set<Path> files;
+    if (readDependencies(output, files)) {
+        group.state = Group::Ready;
+        group.pch = output;
+        for (const Path &file : files) {
+            if (const uint32_t fileId = Location::fileId(file))
+                group.dependencies.insert(fileId);
+        }
+        warning() << "Reusing pch" << output << "for" << group.prefix.size() << "includes";
+        return;
+    }
+
+    // built under a name of its own and renamed when it's done so an
+    // invalidated build can't clobber the next one
+    group.state = Group::Building;
+    group.pch = mDir + String::format<64>("%s-%d.tmp", name.constData(), ++mBuilds);
+
+    List<Path> includes;
+    for (uint32_t fileId : group.prefix)
+        includes << Location::path(fileId);
+    List<String> arguments = group.source.toCommandLine(commandLineFlags);
+    arguments << "-x" << language;
+
+    PchThread *thread = new PchThread(mDir + name + ".h", includes, arguments, group.pch);
+    thread->setAutoDelete(true);
+    std::weak_ptr<PchManager> weak = shared_from_this();
+    const Path pch = group.pch;
+    const uint64_t started = Rct::currentTimeMs();
+    thread->finished().connect<EventLoop::Move>([weak, key, pch, output, started](bool ok, const Set<Path> &files) {
+            std::shared_ptr<PchManager> manager = weak.lock();
+            auto it = manager ? manager->mGroups.find(key) : Hash<uint64_t, Group>::iterator();
+            if (!manager || it == manager->mGroups.end() || it->second.pch != pch) {
+                // invalidated while we were building it
+                unlink(pch.constData());
+                return;
+            }
+            Group &group = it->second;
+            if (!ok) {
+                unlink(pch.constData());
+                group.state = Group::Failed;
+                return;
+            }
+            for (const Path &file : files) {
+                if (file.lastModifiedMs() > started) {
+                    unlink(pch.constData());
+                    group.state = Group::None;
+                    group.pch.clear();
+                    group.dirty = true;
+                    manager->startTimer();
+                    return;
+                }
+                if (const uint32_t fileId = Location::fileId(file))
+                    group.dependencies.insert(fileId);
+            }
+            if (rename(pch.constData(), output.constData()) || !writeDependencies(output, files)) {
+                removePch(output);
+                unlink(pch.constData());
+                group.dependencies.clear();
+                group.state = Group::Failed;
+                return;
+            }
+            group.state = Group::Ready;
+            group.pch = output;
+            warning() << "Built pch" << output << "for" << group.prefix.size() << "includes";
+        });
+    thread->start();
+}
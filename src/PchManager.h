@@ -0,0 +1,75 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef PchManager_h
+#define PchManager_h
+
+#include <rct/Hash.h>
+#include <rct/List.h>
+#include <rct/Path.h>
+#include <rct/Set.h>
+#include <memory>
+#include "Source.h"
+
+// Finds include sequences that many sources with the same arguments start
+// with and builds a precompiled header for them. Sources are grouped on their
+// command line, rdm's defaults applied (see IndexerJob::prepareSource), and
+// each group gets at most one pch which is thrown away when a file in it is
+// modified.
+class PchManager : public std::enable_shared_from_this<PchManager>
+{
+public:
+    PchManager(const Path &dir);
+    ~PchManager();
+
+    // pch to index this source with or an empty path
+    Path pch(const Source &source) const;
+    // the includes a source's main file starts with, from its last index
+    void update(const Source &source, const List<uint32_t> &leadingIncludes);
+    void remove(uint64_t key);
+    void onFileModified(uint32_t fileId);
+private:
+    static uint64_t groupKey(const Source &source);
+    void startTimer();
+    void evaluate();
+    void build(uint64_t groupKey);
+
+    struct Group {
+        Group() : state(None), dirty(false) {}
+        enum State {
+            None,
+            Building,
+            Ready,
+            Failed
+        } state;
+        bool dirty; // sources were added or the pch was invalidated
+        Source source; // any source of the group, to build with
+        List<uint32_t> prefix;
+        Set<uint32_t> dependencies;
+        Path pch;
+    };
+    struct Entry {
+        Entry() : group(0) {}
+        uint64_t group;
+        List<uint32_t> leadingIncludes;
+    };
+
+    const Path mDir;
+    Hash<uint64_t, Group> mGroups;
+    Hash<uint64_t, Entry> mSources; // source key -> group and leading includes
+    int mBuilds, mTimer;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "PchThread.h"
+#include "RTagsClang.h"
+#include <rct/Log.h>
+
+PchThread::PchThread(const Path &header, const List<Path> &includes, const List<String> &arguments, const Path &output)
+    : Thread(), mHeader(header), mIncludes(includes), mArguments(arguments), mOutput(output)
+{
+}
+
+static void inclusionVisitor(CXFile includedFile, CXSourceLocation *, unsigned, CXClientData userData)
+{
+    Set<Path> &files = *reinterpret_cast<Set<Path> *>(userData);
+    const Path path = Path::resolved(RTags::eatString(clang_getFileName(includedFile)));
+    if (!path.isEmpty())
+        files.insert(path);
+}
+
+void PchThread::run()
+{
+    // clang checks the inputs of a pch when it's used so the header has to
+    // exist on disk
+    String contents;
+    for (const Path &include : mIncludes)
+        contents << "#include \"" << include << "\"\n";
+    Path::mkdir(mHeader.parentDir(), Path::Recursive);
+    FILE *f = fopen(mHeader.constData(), "w");
+    if (!f || fwrite(contents.constData(), contents.size(), 1, f) != 1) {
+        if (f)
+            fclose(f);
+        error() << "Failed to write" << mHeader;
+        mFinished(false, Set<Path>());
+        return;
+    }
+    fclose(f);
+
+    CXIndex index = clang_createIndex(0, 0);
+    CXTranslationUnit unit = 0;
+    String clangLine;
+    // the indexer parses with a detailed preprocessing record, the pch needs
+    // one too or macro definitions and expansions from the prefix are lost
+    RTags::parseTranslationUnit(mHeader, mArguments, unit, index, 0, 0,
+                                CXTranslationUnit_Incomplete|CXTranslationUnit_ForSerialization|CXTranslationUnit_DetailedPreprocessingRecord,
+                                &clangLine);
+    bool ok = unit;
+    Set<Path> files;
+    if (unit) {
+        const unsigned int diagnosticCount = clang_getNumDiagnostics(unit);
+        for (unsigned int i=0; ok && i<diagnosticCount; ++i) {
+            CXDiagnostic diagnostic = clang_getDiagnostic(unit, i);
+            if (clang_getDiagnosticSeverity(diagnostic) >= CXDiagnostic_Error)
+                ok = false;
+            clang_disposeDiagnostic(diagnostic);
+        }
+        if (ok)
+            ok = clang_saveTranslationUnit(unit, mOutput.constData(), clang_defaultSaveOptions(unit)) == CXSaveError_None;
+        if (ok)
+            clang_getInclusions(unit, inclusionVisitor, &files);
+        clang_disposeTranslationUnit(unit);
+    }
+    clang_disposeIndex(index);
+    if (!ok)
+        warning() << "Failed to build pch" << mOutput << clangLine;
+    mFinished(ok, files);
+}
@@ -0,0 +1,42 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef PchThread_h
+#define PchThread_h
+
+#include <rct/List.h>
+#include <rct/Path.h>
+#include <rct/Set.h>
+#include <rct/SignalSlot.h>
+#include <rct/String.h>
+#include <rct/Thread.h>
+
+// Builds a precompiled header for a list of includes and reports whether it
+// worked and every file that ended up in it.
+class PchThread : public Thread
+{
+public:
+    PchThread(const Path &header, const List<Path> &includes, const List<String> &arguments, const Path &output);
+    virtual void run() override;
+    Signal<std::function<void(bool, Set<Path>)> > &finished() { return mFinished; }
+private:
+    const Path mHeader;
+    const List<Path> mIncludes;
+    const List<String> mArguments;
+    const Path mOutput;
+    Signal<std::function<void(bool, Set<Path>)> > mFinished;
+};
+
+#endif
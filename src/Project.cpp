@@ -15,11 +15,15 @@
 
 #include "Project.h"
 #include "FileManager.h"
+#include "FileHashThread.h"
+#include "StatThread.h"
 #include "Diagnostic.h"
 #include "IndexerJob.h"
 #include "RTags.h"
 #include "Server.h"
 #include "JobScheduler.h"
+#include "PchManager.h"
+#include "QueryJob.h"
 #include "RTagsLogOutput.h"
 #include <math.h>
 #include <fnmatch.h>
@@ -30,9 +34,11 @@
 #include <rct/Rct.h>
 #include <rct/ReadLocker.h>
 #include <rct/Thread.h>
+#include <rct/ThreadPool.h>
 #include <rct/DataFile.h>
 #include <regex>
 #include <memory>
+#include <condition_variable>
 #include "LogOutputMessage.h"
 
 enum { DirtyTimeout = 100 };
@@ -67,6 +73,9 @@ public:
     virtual ~Dirty() {}
     virtual Set<uint32_t> dirtied() const = 0;
     virtual bool isDirty(const Source &source) = 0;
+    // Returns false if every source has to be checked, otherwise fills in
+    // the fileIds of the only sources that can be dirty.
+    virtual bool candidates(Set<uint32_t> *) const { return false; }
 };
 
 class SimpleDirty : public Dirty
@@ -90,6 +99,12 @@ public:
         return mDirty.contains(source.fileId);
     }
 
+    virtual bool candidates(Set<uint32_t> *fileIds) const override
+    {
+        *fileIds = mDirty;
+        return true;
+    }
+
     Set<uint32_t> mDirty;
 };
 
@@ -112,9 +127,31 @@ public:
         }
         return time;
     }
+    // true if fileId is gone or newer than parsed, unless its contents are
+    // known to be what a source parsed at that time saw
+    inline bool isModified(uint32_t fileId, uint64_t parsed)
+    {
+        const auto unchanged = mUnchanged.find(fileId);
+        if (unchanged != mUnchanged.end() && unchanged->second <= parsed)
+            return false;
+        const uint64_t time = lastModified(fileId);
+        if (!time)
+            return true;
+        if (time > parsed) {
+            mNewer.insert(fileId);
+            return true;
+        }
+        return false;
+    }
 
     Hash<uint32_t, uint64_t> mLastModified;
     Set<uint32_t> mDirty;
+    // files that were newer than a dependent source
+    Set<uint32_t> mNewer;
+    // files that are newer but whose content hash didn't change -> the
+    // parse time the hash was recorded at, sources parsed before that may
+    // have seen other contents
+    Hash<uint32_t, uint64_t> mUnchanged;
 };
 
 class SuspendedDirty : public ComplexDirty
@@ -124,24 +161,38 @@ public:
     {
         return false;
     }
+
+    virtual bool candidates(Set<uint32_t> *fileIds) const override
+    {
+        fileIds->clear();
+        return true;
+    }
 };
 
 class IfModifiedDirty : public ComplexDirty
 {
 public:
-    IfModifiedDirty(const std::shared_ptr<Project> &project, const Match &match = Match())
-        : mProject(project), mMatch(match)
+    IfModifiedDirty(const std::shared_ptr<Project> &project, const Match &match = Match(),
+                    const Set<uint32_t> &sources = Set<uint32_t>())
+        : mProject(project), mMatch(match), mSources(sources)
     {
     }
 
+    virtual bool candidates(Set<uint32_t> *fileIds) const override
+    {
+        if (mSources.isEmpty())
+            return false;
+        *fileIds = mSources;
+        return true;
+    }
+
     virtual bool isDirty(const Source &source) override
     {
         bool ret = false;
 
         if (mMatch.isEmpty() || mMatch.match(source.sourceFile())) {
             for (auto it : mProject->dependencies(source.fileId, Project::ArgDependsOn)) {
-                const uint64_t depLastModified = lastModified(it);
-                if (!depLastModified || depLastModified > source.parsed) {
+                if (isModified(it, source.parsed)) {
                     // dependency is gone
                     ret = true;
                     insertDirtyFile(it);
@@ -157,6 +208,7 @@ public:
 
     std::shared_ptr<Project> mProject;
     Match mMatch;
+    Set<uint32_t> mSources;
 };
 
 
@@ -166,7 +218,8 @@ public:
     WatcherDirty(const std::shared_ptr<Project> &project, const Set<uint32_t> &modified)
     {
         for (auto it : modified) {
-            mModified[it] = project->dependencies(it, Project::DependsOnArg);
+            for (auto dep : project->dependencies(it, Project::DependsOnArg))
+                mModified[dep].insert(it);
         }
     }
 
@@ -174,15 +227,11 @@ public:
     {
         bool ret = false;
 
-        for (auto it : mModified) {
-            const auto &deps = it.second;
-            if (deps.contains(source.fileId)) {
-                const uint64_t depLastModified = lastModified(it.first);
-                if (!depLastModified || depLastModified > source.parsed) {
-                    // dependency is gone
-                    ret = true;
-                    insertDirtyFile(it.first);
-                }
+        for (auto it : mModified.value(source.fileId)) {
+            if (isModified(it, source.parsed)) {
+                // dependency is gone
+                ret = true;
+                insertDirtyFile(it);
             }
         }
 
@@ -191,6 +240,13 @@ public:
         return ret;
     }
 
+    virtual bool candidates(Set<uint32_t> *fileIds) const override
+    {
+        *fileIds = mModified.keys().toSet();
+        return true;
+    }
+
+    // dependent fileId -> the modified files it depends on
     Hash<uint32_t, Set<uint32_t> > mModified;
 };
 
@@ -249,6 +305,7 @@ Project::Project(const Path &path)
     const Path tmp = options.dataDir + srcPath;
     mProjectFilePath = tmp + "/project";
     mSourcesFilePath = tmp + "/sources";
+    mPch = std::make_shared<PchManager>(mSourceFilePathBase + "pch/");
 }
 
 Project::~Project()
@@ -330,25 +387,25 @@ bool Project::init()
         return true;
     }
 
+    Set<uint32_t> diagnosticFiles;
     {
         std::lock_guard<std::mutex> lock(mMutex);
-        file >> mVisitedFiles >> mDiagnostics;
+        file >> mVisitedFiles;
     }
-    file >> mDeclarations;
+    file >> diagnosticFiles >> mDeclarations >> mFileHashes >> mIndexCosts;
     loadDependencies(file, mDependencies);
+    mSnapshot.reset();
+    mSnapshotFiles.clear();
+    mSnapshotUsrs.clear();
+    for (uint32_t fileId : diagnosticFiles)
+        loadDiagnostics(fileId);
 
     for (const auto &dep : mDependencies) {
         watchFile(dep.first);
     }
 
     bool needsSave = false;
-    std::unique_ptr<ComplexDirty> dirty;
-
-    if (Server::instance()->suspended()) {
-        dirty.reset(new SuspendedDirty);
-    } else {
-        dirty.reset(new IfModifiedDirty(shared_from_this()));
-    }
+    Set<uint32_t> dirtyFiles;
 
     Set<uint32_t> missingFileMaps;
     {
@@ -364,11 +421,11 @@ bool Project::init()
             const Path path = Location::path(it.first);
             if (!path.isFile()) {
                 warning() << path << "seems to have disappeared";
-                dirty.get()->insertDirtyFile(it.first);
+                dirtyFiles.insert(it.first);
 
                 const Set<uint32_t> dependents = dependencies(it.first, DependsOnArg);
                 for (auto dependent : dependents) {
-                    dirty.get()->insertDirtyFile(dependent);
+                    dirtyFiles.insert(dependent);
                 }
                 removed << it.first;
                 needsSave = true;
@@ -410,7 +467,7 @@ bool Project::init()
         if (!sourceFile.isFile()) {
             warning() << source.sourceFile() << "seems to have disappeared";
             removeDependencies(source.fileId);
-            dirty.get()->insertDirtyFile(source.fileId);
+            dirtyFiles.insert(source.fileId);
             mSources.erase(it++);
             needsSave = true;
         } else {
@@ -421,7 +478,13 @@ bool Project::init()
 
     if (needsSave)
         save();
-    startDirtyJobs(dirty.get());
+    if (Server::instance()->suspended()) {
+        SuspendedDirty dirty;
+        dirty.mDirty = dirtyFiles;
+        startDirtyJobs(&dirty);
+    } else {
+        startStalenessScan(dirtyFiles);
+    }
     if (!missingFileMaps.isEmpty()) {
         SimpleDirty simple;
         simple.init(missingFileMaps, shared_from_this());
@@ -460,26 +523,39 @@ enum DiagnosticsFormat {
     Diagnostics_Elisp
 };
 
-static inline bool remove(Diagnostics &diags, uint32_t file)
-{
-    Diagnostics::iterator it = diags.lower_bound(Location(file, 0, 0));
-    bool ret = false;
-    while (it != diags.end() && it->first.fileId() == file) {
-        diags.erase(it++);
-        ret = true;
+static Set<uint32_t> updateDiagnostics(const Diagnostics &newDiags, Map<uint32_t, Diagnostics> &diagnostics)
+{
+    // newDiags is sorted on location so each file's entries are contiguous. A
+    // visited file without any diagnostics gets a single Diagnostic::None entry
+    Set<uint32_t> changed;
+    auto it = newDiags.begin();
+    while (it != newDiags.end()) {
+        const uint32_t fileId = it->first.fileId();
+        Diagnostics bucket;
+        do {
+            if (it->second.type != Diagnostic::None)
+                bucket[it->first] = it->second;
+            ++it;
+        } while (it != newDiags.end() && it->first.fileId() == fileId);
+
+        if (bucket.isEmpty()) {
+            if (diagnostics.remove(fileId))
+                changed.insert(fileId);
+        } else {
+            diagnostics[fileId] = std::move(bucket);
+            changed.insert(fileId);
+        }
     }
-    return ret;
+    return changed;
 }
 
-struct FormatDiagnosticsOperation {
-    DiagnosticsFormat format;
-    Diagnostics newDiags;
-    uint32_t fileId;
-    bool all;
-};
-
-static String formatDiagnostics(const FormatDiagnosticsOperation &op, Diagnostics &diagnostics)
+static String formatDiagnostics(DiagnosticsFormat format,
+                                const Set<uint32_t> &files,
+                                const Map<uint32_t, Diagnostics> &diagnostics)
 {
+    if (files.isEmpty())
+        return String();
+
     const char *severities[] = { "none", "warning", "error", "fixit", "skipped" };
 
     static const char *header[] = {
@@ -503,7 +579,7 @@ static String formatDiagnostics(const FormatDiagnosticsOperation &op, Diagnostic
         ")"
     };
     std::function<String(const Location &, const Diagnostic &)> formatDiagnostic;
-    if (op.format == Diagnostics_XML) {
+    if (format == Diagnostics_XML) {
         formatDiagnostic = [severities](const Location &loc, const Diagnostic &diagnostic) {
             return String::format<256>("\n      <error line=\"%d\" column=\"%d\" %sseverity=\"%s\" message=\"%s\"/>",
                                        loc.line(), loc.column(),
@@ -520,93 +596,22 @@ static String formatDiagnostics(const FormatDiagnosticsOperation &op, Diagnostic
                                        RTags::elispEscape(diagnostic.message).constData());
         };
     }
-    if (op.fileId) {
-        String ret;
-        assert(op.newDiags.isEmpty());
-        assert(!op.all);
-        const Path path = Location::path(op.fileId);
-        ret << header[op.format]
-            << String::format<256>(startFile[op.format], path.constData());
-
-        Diagnostics::iterator it = diagnostics.lower_bound(Location(op.fileId, 0, 0));
-        bool found = false;
-        while (it != diagnostics.end() && it->first.fileId() == op.fileId) {
-            found = true;
-            ret << formatDiagnostic(it->first, it->second);
-            ++it;
-        }
-        if (!found) {
-            ret << String::format<256>(fileEmpty[op.format], path.constData());
-        }
-        ret << endFile[op.format] << trailer[op.format];
-        return ret;
-    }
 
-    if (op.all) {
-        String ret;
-        uint32_t lastFileId = 0;
-        bool first = true;
-        for (const auto &entry : diagnostics) {
-            const Location &loc = entry.first;
-            const Diagnostic &diagnostic = entry.second;
-            if (loc.fileId() != lastFileId) {
-                if (first) {
-                    ret = header[op.format];
-                    first = false;
-                }
-                if (lastFileId)
-                    ret << endFile[op.format];
-                lastFileId = loc.fileId();
-                ret << String::format<256>(startFile[op.format], loc.path().constData());
-            }
-            diagnostics[entry.first] = entry.second;
-            ret << formatDiagnostic(loc, diagnostic);
+    String ret = header[format];
+    for (uint32_t fileId : files) {
+        const Path path = Location::path(fileId);
+        const auto bucket = diagnostics.find(fileId);
+        if (bucket == diagnostics.end()) {
+            ret << String::format<256>(fileEmpty[format], path.constData());
+            continue;
         }
-        if (lastFileId)
-            ret << endFile[op.format];
-        if (!first)
-            ret << trailer[op.format];
-        return ret;
-    }
-
-    String ret;
-    bool first = true;
-    uint32_t lastFileId = 0;
-    for (const auto &entry : op.newDiags) {
-        const Location &loc = entry.first;
-        const Diagnostic &diagnostic = entry.second;
-        if (diagnostic.type == Diagnostic::None) {
-            if (lastFileId) {
-                ret << endFile[op.format];
-                lastFileId = 0;
-            }
-            if (::remove(diagnostics, entry.first.fileId())) {
-                if (first) {
-                    ret = header[op.format];
-                    first = false;
-                }
-                ret << String::format<256>(fileEmpty[op.format], loc.path().constData());
-            }
-        } else {
-            if (loc.fileId() != lastFileId) {
-                ::remove(diagnostics, entry.first.fileId());
-                if (first) {
-                    ret = header[op.format];
-                    first = false;
-                }
-                if (lastFileId)
-                    ret << endFile[op.format];
-                lastFileId = loc.fileId();
-                ret << String::format<256>(startFile[op.format], loc.path().constData());
-            }
-            diagnostics[entry.first] = entry.second;
-            ret << formatDiagnostic(loc, diagnostic);
+        ret << String::format<256>(startFile[format], path.constData());
+        for (const auto &entry : bucket->second) {
+            ret << formatDiagnostic(entry.first, entry.second);
         }
+        ret << endFile[format];
     }
-    if (lastFileId)
-        ret << endFile[op.format];
-    if (!first)
-        ret << trailer[op.format];
+    ret << trailer[format];
     return ret;
 }
 
@@ -649,7 +654,10 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
     }
 
     const int idx = mJobCounter - mActiveJobs.size();
-    if (!msg->diagnostics().isEmpty() || options.options & Server::Progress) {
+    const Set<uint32_t> changedDiagnostics = ::updateDiagnostics(msg->diagnostics(), mDiagnostics);
+    for (uint32_t file : changedDiagnostics)
+        saveDiagnostics(file);
+    if (!changedDiagnostics.isEmpty() || options.options & Server::Progress) {
         log([&](const std::shared_ptr<LogOutput> &output) {
                 if (output->testLog(RTags::Diagnostics)) {
                     DiagnosticsFormat format = Diagnostics_XML;
@@ -658,19 +666,19 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
                         // true for testLog(RTags::Diagnostics)
                         format = Diagnostics_Elisp;
                     }
-                    if (!msg->diagnostics().isEmpty()) {
-                        const FormatDiagnosticsOperation op = { format, msg->diagnostics(), 0, false };
-                        const String log = formatDiagnostics(op, mDiagnostics);
+                    if (!changedDiagnostics.isEmpty()) {
+                        const String log = formatDiagnostics(format, changedDiagnostics, mDiagnostics);
                         if (!log.isEmpty()) {
                             output->log(log);
                         }
                     }
                     if (options.options & Server::Progress) {
+                        const unsigned long long eta = Server::instance()->jobScheduler()->eta() / 1000;
                         if (format == Diagnostics_XML) {
-                            output->log("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<progress index=\"%d\" total=\"%d\"></progress>",
-                                        idx, mJobCounter);
+                            output->log("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<progress index=\"%d\" total=\"%d\" eta=\"%llu\"></progress>",
+                                        idx, mJobCounter, eta);
                         } else {
-                            output->log("(list 'progress %d %d)", idx, mJobCounter);
+                            output->log("(list 'progress %d %d %llu)", idx, mJobCounter, eta);
                         }
                     }
                 }
@@ -682,8 +690,19 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
     updateFixIts(visited, msg->fixIts());
     updateDependencies(msg);
     updateDeclarations(visited, msg->declarations());
+    mQueryCache.invalidate(visited);
+    for (uint32_t file : visited) {
+        const RTags::FileHash hash = msg->fileHashes().value(file);
+        if (hash.hash) {
+            mFileHashes[file] = hash;
+        } else {
+            mFileHashes.remove(file);
+        }
+    }
     if (success) {
         src->second.parsed = msg->parseTime();
+        mIndexCosts[msg->key()].update(msg->cost());
+        mPch->update(IndexerJob::prepareSource(src->second), msg->leadingIncludes());
         error("[%3d%%] %d/%d %s %s. (%s)",
               static_cast<int>(round((double(idx) / double(mJobCounter)) * 100.0)), idx, mJobCounter,
               String::formatTime(time(0), String::Time).constData(),
@@ -723,8 +742,9 @@ void Project::diagnose(uint32_t fileId)
                     // true for testLog(RTags::Diagnostics)
                     format = Diagnostics_Elisp;
                 }
-                const FormatDiagnosticsOperation op = { format, Diagnostics(), fileId, false } ;
-                const String log = formatDiagnostics(op, mDiagnostics);
+                Set<uint32_t> files;
+                files.insert(fileId);
+                const String log = formatDiagnostics(format, files, mDiagnostics);
                 if (!log.isEmpty())
                     output->log(log);
             }
@@ -741,8 +761,7 @@ void Project::diagnoseAll()
                     // true for testLog(RTags::Diagnostics)
                     format = Diagnostics_Elisp;
                 }
-                const FormatDiagnosticsOperation op = { format, Diagnostics(), 0, true } ;
-                const String log = formatDiagnostics(op, mDiagnostics);
+                const String log = formatDiagnostics(format, mDiagnostics.keys().toSet(), mDiagnostics);
                 if (!log.isEmpty())
                     output->log(log);
             }
@@ -768,9 +787,10 @@ bool Project::save()
         }
         {
             std::lock_guard<std::mutex> lock(mMutex);
-            file << mVisitedFiles << mDiagnostics;
+            file << mVisitedFiles;
         }
-        file << mDeclarations;
+        // the diagnostics themselves live next to the file maps, see saveDiagnostics()
+        file << mDiagnostics.keys().toSet() << mDeclarations << mFileHashes << mIndexCosts;
         saveDependencies(file, mDependencies);
         if (!file.flush()) {
             error("Save error %s: %s", mProjectFilePath.constData(), file.error().constData());
@@ -781,6 +801,43 @@ bool Project::save()
     return true;
 }
 
+void Project::loadDiagnostics(uint32_t fileId)
+{
+    DataFile file(sourceFilePath(fileId, "diagnostics"), RTags::DatabaseVersion);
+    if (!file.open(DataFile::Read)) {
+        if (!file.error().isEmpty())
+            error("Diagnostics restore error %s: %s", Location::path(fileId).constData(), file.error().constData());
+        return;
+    }
+    Diagnostics &diagnostics = mDiagnostics[fileId];
+    file >> diagnostics;
+    if (diagnostics.isEmpty())
+        mDiagnostics.remove(fileId);
+}
+
+bool Project::saveDiagnostics(uint32_t fileId)
+{
+    const Path path = sourceFilePath(fileId, "diagnostics");
+    const auto it = mDiagnostics.find(fileId);
+    if (it == mDiagnostics.end()) {
+        Path::rm(path);
+        return true;
+    }
+
+    Path::mkdir(path.parentDir(), Path::Recursive);
+    DataFile file(path, RTags::DatabaseVersion);
+    if (!file.open(DataFile::Write)) {
+        error("Save error %s: %s", path.constData(), file.error().constData());
+        return false;
+    }
+    file << it->second;
+    if (!file.flush()) {
+        error("Save error %s: %s", path.constData(), file.error().constData());
+        return false;
+    }
+    return true;
+}
+
 static inline void markActive(Sources::iterator start, uint32_t buildId, const Sources::iterator end)
 {
     const uint32_t fileId = start->second.fileId;
@@ -850,7 +907,13 @@ void Project::index(const std::shared_ptr<IndexerJob> &job)
                         break;
 
                     if (it->second.compareArguments(job->source)) {
-                        markActive(start, b, mSources.end());
+                        // e.g. another build root that only differs in -O,
+                        // remember it but share the index
+                        const uint64_t parsed = it->second.parsed;
+                        Source &shared = mSources[key];
+                        shared = job->source;
+                        shared.parsed = parsed;
+                        markActive(mSources.lower_bound(Source::key(job->source.fileId, 0)), b, mSources.end());
                         // no updates
                         return;
                     } else if (disallowMultiple) {
@@ -911,6 +974,7 @@ void Project::onFileAddedOrModified(const Path &file)
         return;
     }
     Server::instance()->jobScheduler()->clearHeaderError(fileId);
+    mPch->onFileModified(fileId);
     if (mPendingDirtyFiles.insert(fileId)) {
         mDirtyTimer.restart(DirtyTimeout, Timer::SingleShot);
     }
@@ -923,6 +987,9 @@ void Project::onFileRemoved(const Path &file)
     if (!fileId)
         return;
     Rct::removeDirectory(Project::sourceFilePath(fileId));
+    mDiagnostics.remove(fileId);
+    mFileHashes.remove(fileId);
+    mQueryCache.invalidate(fileId);
 
     const uint64_t key = Source::key(fileId, 0);
     auto it = mSources.lower_bound(key);
@@ -939,6 +1006,8 @@ void Project::onFileRemoved(const Path &file)
             Server::instance()->jobScheduler()->abort(job);
         }
         debug() << "Erasing source" << Location::path(f);
+        mIndexCosts.remove(it->first);
+        mPch->remove(it->first);
         mSources.erase(it++);
     }
 
@@ -958,9 +1027,8 @@ void Project::onFileRemoved(const Path &file)
 void Project::onDirtyTimeout(Timer *)
 {
     Set<uint32_t> dirtyFiles = std::move(mPendingDirtyFiles);
-    WatcherDirty dirty(shared_from_this(), dirtyFiles);
-    const int dirtied = startDirtyJobs(&dirty);
-    debug() << "onDirtyTimeout" << dirtyFiles << dirtied;
+    debug() << "onDirtyTimeout" << dirtyFiles;
+    startContentCheckedDirtyJobs(std::make_shared<WatcherDirty>(shared_from_this(), dirtyFiles));
 }
 
 List<Source> Project::sources(uint32_t fileId) const
@@ -995,8 +1063,19 @@ Set<uint32_t> Project::dependencies(uint32_t fileId, DependencyMode mode) const
 {
     Set<uint32_t> ret;
     ret.insert(fileId);
+    const Snapshot *snapshot = threadSnapshot();
     std::function<void(uint32_t)> fill = [&](uint32_t fileId) {
-        if (DependencyNode *node = mDependencies.value(fileId)) {
+        if (isCancelled())
+            return;
+        if (snapshot) {
+            const auto node = snapshot->dependencies.find(fileId);
+            if (node == snapshot->dependencies.end())
+                return;
+            for (uint32_t file : (mode == ArgDependsOn ? node->second->includes : node->second->dependents)) {
+                if (ret.insert(file))
+                    fill(file);
+            }
+        } else if (DependencyNode *node = mDependencies.value(fileId)) {
             const auto &nodes = (mode == ArgDependsOn ? node->includes : node->dependents);
             for (const auto &it : nodes) {
                 if (ret.insert(it.first))
@@ -1011,6 +1090,23 @@ Set<uint32_t> Project::dependencies(uint32_t fileId, DependencyMode mode) const
 bool Project::dependsOn(uint32_t source, uint32_t header) const
 {
     Set<uint32_t> seen;
+    if (const Snapshot *snapshot = threadSnapshot()) {
+        std::function<bool(uint32_t)> dep = [&](uint32_t file) {
+            if (!seen.insert(file))
+                return false;
+            const auto node = snapshot->dependencies.find(file);
+            if (node == snapshot->dependencies.end())
+                return false;
+            if (node->second->dependents.contains(source))
+                return true;
+            for (uint32_t dependent : node->second->dependents) {
+                if (dep(dependent))
+                    return true;
+            }
+            return false;
+        };
+        return dep(header);
+    }
     std::function<bool(DependencyNode *node)> dep = [&](DependencyNode *node) {
         assert(node);
         if (!seen.insert(node->fileId))
@@ -1027,14 +1123,91 @@ bool Project::dependsOn(uint32_t source, uint32_t header) const
     return node && dep(node);
 }
 
+List<uint32_t> Project::dependencyFiles() const
+{
+    if (FileMapScope *scope = fileMapScope())
+        scope->allFiles = true;
+    List<uint32_t> ret;
+    if (const Snapshot *snapshot = threadSnapshot()) {
+        ret.reserve(snapshot->dependencies.size());
+        for (const auto &it : snapshot->dependencies)
+            ret.append(it.first);
+    } else {
+        ret.reserve(mDependencies.size());
+        for (const auto &it : mDependencies)
+            ret.append(it.first);
+    }
+    return ret;
+}
+
+bool Project::isDeclaration(const String &usr) const
+{
+    if (const Snapshot *snapshot = threadSnapshot())
+        return snapshot->declarations.contains(usr);
+    return mDeclarations.contains(usr);
+}
+
+static std::shared_ptr<const Project::Snapshot::Node> snapshotNode(const DependencyNode *dep)
+{
+    std::shared_ptr<Project::Snapshot::Node> node = std::make_shared<Project::Snapshot::Node>();
+    for (const auto &include : dep->includes)
+        node->includes.insert(include.first);
+    for (const auto &dependent : dep->dependents)
+        node->dependents.insert(dependent.first);
+    return node;
+}
+
+std::shared_ptr<const Project::Snapshot> Project::snapshot()
+{
+    assert(EventLoop::isMainThread());
+    if (!mSnapshot) {
+        mSnapshot = std::make_shared<Snapshot>();
+        for (const auto &it : mDependencies)
+            mSnapshot->dependencies[it.first] = snapshotNode(it.second);
+        for (const auto &it : mDeclarations)
+            mSnapshot->declarations.insert(it.first);
+    } else if (!mSnapshotFiles.isEmpty() || !mSnapshotUsrs.isEmpty()) {
+        // Nobody else can get hold of a snapshot off the main thread so if
+        // no query holds this one it can be updated in place. Otherwise the
+        // queries keep theirs and the new one shares its unchanged nodes.
+        if (mSnapshot.use_count() > 1)
+            mSnapshot = std::make_shared<Snapshot>(*mSnapshot);
+        for (uint32_t fileId : mSnapshotFiles) {
+            if (const DependencyNode *dep = mDependencies.value(fileId)) {
+                mSnapshot->dependencies[fileId] = snapshotNode(dep);
+            } else {
+                mSnapshot->dependencies.remove(fileId);
+            }
+        }
+        for (const String &usr : mSnapshotUsrs) {
+            if (mDeclarations.contains(usr)) {
+                mSnapshot->declarations.insert(usr);
+            } else {
+                mSnapshot->declarations.remove(usr);
+            }
+        }
+    }
+    mSnapshotFiles.clear();
+    mSnapshotUsrs.clear();
+    return mSnapshot;
+}
+
 void Project::removeDependencies(uint32_t fileId)
 {
     if (DependencyNode *node = mDependencies.take(fileId)) {
-        for (auto it : node->includes)
+        Set<uint32_t> changed;
+        changed.insert(fileId);
+        for (auto it : node->includes) {
             it.second->dependents.remove(fileId);
-        for (auto it : node->dependents)
+            changed.insert(it.first);
+        }
+        for (auto it : node->dependents) {
             it.second->includes.remove(fileId);
+            changed.insert(it.first);
+        }
         delete node;
+        mSnapshotFiles.unite(changed);
+        mQueryCache.invalidate(changed);
     }
 }
 
@@ -1042,20 +1215,29 @@ void Project::updateDependencies(const std::shared_ptr<IndexDataMessage> &msg)
 {
     const bool prune = !(msg->flags() & (IndexDataMessage::InclusionError|IndexDataMessage::ParseFailure));
     Set<uint32_t> files;
+    // files whose includes or dependents change, for the query cache
+    Set<uint32_t> changed;
+    Hash<uint32_t, Set<uint32_t> > pruned;
     for (auto pair : msg->files()) {
         DependencyNode *&node = mDependencies[pair.first];
         if (!node) {
             node = new DependencyNode(pair.first);
+            changed.insert(pair.first);
             if (pair.second & IndexDataMessage::Visited)
                 files.insert(pair.first);
         } else if (pair.second & IndexDataMessage::Visited) {
             files.insert(pair.first);
             if (prune) {
-                for (auto it : node->includes)
+                Set<uint32_t> &includes = pruned[pair.first];
+                for (auto it : node->includes) {
                     it.second->dependents.remove(pair.first);
+                    includes.insert(it.first);
+                }
                 node->includes.clear();
+                mSnapshotFiles.unite(includes);
             }
         }
+        mSnapshotFiles.insert(pair.first);
         watchFile(pair.first);
     }
 
@@ -1065,12 +1247,29 @@ void Project::updateDependencies(const std::shared_ptr<IndexDataMessage> &msg)
         DependencyNode *&inclusiary = mDependencies[it.second];
         files.insert(it.first);
         files.insert(it.second);
-        if (!includer)
+        mSnapshotFiles.insert(it.first);
+        mSnapshotFiles.insert(it.second);
+        if (!includer) {
             includer = new DependencyNode(it.first);
-        if (!inclusiary)
+            changed.insert(it.first);
+        }
+        if (!inclusiary) {
             inclusiary = new DependencyNode(it.second);
+            changed.insert(it.second);
+        }
+        if (!includer->includes.contains(it.second)) {
+            auto p = pruned.find(it.first);
+            if (p == pruned.end() || !p->second.remove(it.second))
+                changed.insert(it.second);
+        }
         includer->include(inclusiary);
     }
+    for (const auto &p : pruned) {
+        // includes that are gone
+        changed.unite(p.second);
+    }
+    if (!changed.isEmpty())
+        mQueryCache.invalidate(changed);
 }
 
 void Project::updateDeclarations(const Set<uint32_t> &visited, Declarations &declarations)
@@ -1078,6 +1277,7 @@ void Project::updateDeclarations(const Set<uint32_t> &visited, Declarations &dec
     auto it = mDeclarations.begin();
     while (it != mDeclarations.end()) {
         if (it->second.remove([&visited](uint32_t key) { return visited.contains(key); }) && it->second.isEmpty()) {
+            mSnapshotUsrs.insert(it->first);
             mDeclarations.erase(it++);
         } else {
             ++it;
@@ -1086,6 +1286,7 @@ void Project::updateDeclarations(const Set<uint32_t> &visited, Declarations &dec
     for (auto &u : declarations) {
         auto &cur = mDeclarations[u.first];
         if (cur.isEmpty()) {
+            mSnapshotUsrs.insert(u.first);
             cur = std::move(u.second);
         } else {
             cur.unite(u.second);
@@ -1127,6 +1328,8 @@ int Project::remove(const Match &match)
             const uint32_t fileId = it->second.fileId;
             const uint64_t key = it->first;
             mSources.erase(it++);
+            mIndexCosts.remove(key);
+            mPch->remove(key);
             std::shared_ptr<IndexerJob> job = mActiveJobs.take(key);
             if (job) {
                 releaseFileIds(job->visited);
@@ -1142,15 +1345,38 @@ int Project::remove(const Match &match)
     return count;
 }
 
-int Project::startDirtyJobs(Dirty *dirty, const UnsavedFiles &unsavedFiles, const std::shared_ptr<Connection> &wait)
+List<Source> Project::dirtySources(Dirty *dirty) const
 {
-    const JobScheduler::JobScope scope(Server::instance()->jobScheduler());
     List<Source> toIndex;
-    for (const auto &source : mSources) {
-        if (source.second.flags & Source::Active && dirty->isDirty(source.second)) {
-            toIndex << source.second;
+    Set<uint32_t> candidates;
+    if (dirty->candidates(&candidates)) {
+        // mSources is keyed on fileId first so each candidate is a range
+        for (uint32_t fileId : candidates) {
+            auto it = mSources.lower_bound(Source::key(fileId, 0));
+            while (it != mSources.end()) {
+                uint32_t f, b;
+                Source::decodeKey(it->first, f, b);
+                if (f != fileId)
+                    break;
+                if (it->second.flags & Source::Active && dirty->isDirty(it->second))
+                    toIndex << it->second;
+                ++it;
+            }
+        }
+    } else {
+        for (const auto &source : mSources) {
+            if (source.second.flags & Source::Active && dirty->isDirty(source.second)) {
+                toIndex << source.second;
+            }
         }
     }
+    return toIndex;
+}
+
+int Project::startDirtyJobs(Dirty *dirty, const UnsavedFiles &unsavedFiles, const std::shared_ptr<Connection> &wait)
+{
+    const JobScheduler::JobScope scope(Server::instance()->jobScheduler());
+    const List<Source> toIndex = dirtySources(dirty);
     const Set<uint32_t> dirtyFiles = dirty->dirtied();
 
     {
@@ -1164,6 +1390,7 @@ int Project::startDirtyJobs(Dirty *dirty, const UnsavedFiles &unsavedFiles, cons
     for (const auto &source : toIndex) {
         std::shared_ptr<IndexerJob> job(new IndexerJob(source, IndexerJob::Dirty, shared_from_this(), unsavedFiles));
         if (wait) {
+            job->lane = IndexerJob::InteractiveLane;
             job->destroyed.connect([weakConn](IndexerJob *) {
                     if (auto strong = weakConn.lock()) {
                         strong->finish();
@@ -1176,6 +1403,136 @@ int Project::startDirtyJobs(Dirty *dirty, const UnsavedFiles &unsavedFiles, cons
     return toIndex.size();
 }
 
+void Project::startContentCheckedDirtyJobs(const std::shared_ptr<ComplexDirty> &dirty)
+{
+    // A first pass only looks at modification times. The files that are
+    // newer and that we have a content hash for are hashed on a thread and
+    // the ones that turn out to be identical are ignored when the jobs are
+    // started for real.
+    const Set<uint32_t> dirtyFiles = dirty->mDirty;
+    dirtySources(dirty.get());
+    dirty->mDirty = dirtyFiles;
+
+    Hash<uint32_t, Path> toHash;
+    for (uint32_t fileId : dirty->mNewer) {
+        const auto hash = mFileHashes.find(fileId);
+        if (hash == mFileHashes.end())
+            continue;
+        if (hash->second.lastModified == dirty->lastModified(fileId)) {
+            // hashed at this modification time before, it didn't change
+            dirty->mUnchanged[fileId] = hash->second.recorded;
+        } else {
+            toHash[fileId] = Location::path(fileId);
+        }
+    }
+    if (toHash.isEmpty()) {
+        startDirtyJobs(dirty.get());
+        return;
+    }
+
+    FileHashThread *thread = new FileHashThread(toHash);
+    thread->setAutoDelete(true);
+    std::weak_ptr<Project> weak = shared_from_this();
+    thread->finished().connect<EventLoop::Move>([weak, dirty](const Hash<uint32_t, RTags::FileHash> &hashes) {
+            std::shared_ptr<Project> project = weak.lock();
+            if (!project)
+                return;
+            for (const auto &it : hashes) {
+                auto hash = project->mFileHashes.find(it.first);
+                if (it.second.lastModified && hash != project->mFileHashes.end() && hash->second.hash == it.second.hash) {
+                    dirty->mUnchanged[it.first] = hash->second.recorded;
+                    // a touch, don't hash it again until it's modified again
+                    hash->second.lastModified = it.second.lastModified;
+                }
+            }
+            debug() << "Ignoring unchanged files" << dirty->mUnchanged.keys();
+            project->startDirtyJobs(dirty.get());
+        });
+    thread->start();
+}
+
+void Project::startStalenessScan(const Set<uint32_t> &dirty)
+{
+    enum { BatchSize = 256 };
+    std::shared_ptr<StalenessScan> scan = std::make_shared<StalenessScan>();
+    scan->dirty = dirty;
+    Set<uint32_t> assigned;
+    StalenessScan::Batch *batch = 0;
+    uint32_t lastFileId = 0;
+    for (const auto &source : mSources) {
+        if (!(source.second.flags & Source::Active))
+            continue;
+        // the builds of a file are next to each other in mSources, keep
+        // them in one batch so the file is only dirtied once
+        const uint32_t fileId = source.second.fileId;
+        if (fileId == lastFileId)
+            continue;
+        lastFileId = fileId;
+        if (!batch || batch->sources.size() == BatchSize) {
+            scan->batches.append(StalenessScan::Batch());
+            batch = &scan->batches.back();
+        }
+        batch->sources.insert(fileId);
+        for (uint32_t dep : dependencies(fileId, ArgDependsOn)) {
+            batch->dependencies.insert(dep);
+            if (assigned.insert(dep))
+                batch->files[dep] = Location::path(dep);
+        }
+    }
+    if (scan->batches.isEmpty()) {
+        IfModifiedDirty dirty(shared_from_this());
+        dirty.mDirty = scan->dirty;
+        startDirtyJobs(&dirty);
+        return;
+    }
+    startStatThreads(scan);
+}
+
+void Project::startStatThreads(const std::shared_ptr<StalenessScan> &scan)
+{
+    const int max = std::max(2, ThreadPool::idealThreadCount());
+    std::weak_ptr<Project> weak = shared_from_this();
+    while (scan->running < max && scan->started < scan->batches.size()) {
+        const int idx = scan->started++;
+        ++scan->running;
+        StatThread *thread = new StatThread(scan->batches.at(idx).files);
+        thread->setAutoDelete(true);
+        thread->finished().connect<EventLoop::Move>([weak, scan, idx](const Hash<uint32_t, uint64_t> &lastModified) {
+                if (std::shared_ptr<Project> project = weak.lock())
+                    project->onStatThreadFinished(scan, idx, lastModified);
+            });
+        thread->start();
+    }
+}
+
+void Project::onStatThreadFinished(const std::shared_ptr<StalenessScan> &scan, int idx,
+                                   const Hash<uint32_t, uint64_t> &lastModified)
+{
+    assert(EventLoop::isMainThread());
+    --scan->running;
+    scan->lastModified.unite(lastModified);
+    scan->batches[idx].done = true;
+    startStatThreads(scan);
+
+    // a batch can only be decided when every batch before it is done since
+    // that's where the rest of its dependencies were stat'ed
+    while (scan->finished < scan->batches.size() && scan->batches.at(scan->finished).done) {
+        StalenessScan::Batch &batch = scan->batches[scan->finished];
+        std::shared_ptr<IfModifiedDirty> dirty = std::make_shared<IfModifiedDirty>(shared_from_this(), Match(), batch.sources);
+        for (uint32_t dep : batch.dependencies) {
+            const uint64_t time = scan->lastModified.value(dep);
+            if (time)
+                dirty->mLastModified[dep] = time;
+        }
+        if (!scan->finished)
+            dirty->mDirty = scan->dirty;
+        batch.dependencies.clear();
+        batch.files.clear();
+        ++scan->finished;
+        startContentCheckedDirtyJobs(dirty);
+    }
+}
+
 bool Project::isIndexed(uint32_t fileId) const
 {
     {
@@ -1231,6 +1588,11 @@ void Project::updateFixIts(const Set<uint32_t> &visited, FixIts &fixIts)
     }
 }
 
+Path Project::pch(const Source &source) const
+{
+    return mPch->pch(source);
+}
+
 String Project::fixIts(uint32_t fileId) const
 {
     const auto it = mFixIts.find(fileId);
@@ -1289,6 +1651,8 @@ void Project::findSymbols(const String &string,
         }
 
         for (int i=idx; i<count; ++i) {
+            if (isCancelled())
+                return;
             const String &entry = symNames->keyAt(i);
             // error() << i << count << entry;
             SymbolMatchType type = Exact;
@@ -1316,8 +1680,10 @@ void Project::findSymbols(const String &string,
     if (fileFilter) {
         processFile(fileFilter);
     } else {
-        for (const auto &dep : mDependencies) {
-            processFile(dep.first);
+        for (uint32_t file : dependencyFiles()) {
+            if (isCancelled())
+                break;
+            processFile(file);
         }
     }
 }
@@ -1523,10 +1889,11 @@ Set<Symbol> Project::findByUsr(const String &usr, uint32_t fileId, DependencyMod
         ret.insert(sym);
         return ret;
     }
-    if (mDeclarations.contains(usr)) {
-        assert(!mDeclarations.value(usr).isEmpty());
-        for (const auto &dep : mDependencies) {
-            auto usrs = openUsrs(dep.first);
+    if (isDeclaration(usr)) {
+        for (uint32_t file : dependencyFiles()) {
+            if (isCancelled())
+                break;
+            auto usrs = openUsrs(file);
             if (usrs) {
                 for (const Location &loc : usrs->value(usr)) {
                     const Symbol c = findSymbol(loc);
@@ -1537,6 +1904,8 @@ Set<Symbol> Project::findByUsr(const String &usr, uint32_t fileId, DependencyMod
         }
     } else {
         for (uint32_t file : dependencies(fileId, mode)) {
+            if (isCancelled())
+                break;
             auto usrs = openUsrs(file);
             // error() << usrs << Location::path(file) << usr;
             if (usrs) {
@@ -1555,15 +1924,144 @@ Set<Symbol> Project::findByUsr(const String &usr, uint32_t fileId, DependencyMod
     return ret;
 }
 
+struct ScanFilesState
+{
+    ScanFilesState(const List<uint32_t> &f, const std::function<void(uint32_t, Set<Symbol> &)> &s, int chunks)
+        : files(f), scan(s), results(chunks), scopeFiles(chunks), allFiles(false), pending(chunks - 1)
+    {}
+
+    const List<uint32_t> files;
+    const std::function<void(uint32_t, Set<Symbol> &)> scan;
+    List<Set<Symbol> > results;
+    List<Set<uint32_t> > scopeFiles;
+    bool allFiles;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    int pending;
+};
+
+class ScanFilesJob : public ThreadPool::Job
+{
+public:
+    ScanFilesJob(Project *project, const std::shared_ptr<const Project::Snapshot> &snapshot,
+                 const Project::CancelToken &cancel, const std::shared_ptr<ScanFilesState> &state, int chunk)
+        : mProject(project), mSnapshot(snapshot), mCancel(cancel), mState(state), mChunk(chunk)
+    {}
+protected:
+    virtual void run() override
+    {
+        ScanFilesState &state = *mState;
+        const int chunks = state.results.size();
+        mProject->beginScope(mSnapshot, mCancel);
+        for (int i=mChunk; i<state.files.size() && !mProject->isCancelled(); i += chunks)
+            state.scan(state.files.at(i), state.results[mChunk]);
+        bool allFiles;
+        state.scopeFiles[mChunk] = mProject->scopeFiles(&allFiles);
+        mProject->endScope();
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (allFiles)
+            state.allFiles = true;
+        if (!--state.pending)
+            state.condition.notify_one();
+    }
+private:
+    // the caller waits for all chunks so the project outlives the job's run()
+    Project *mProject;
+    const std::shared_ptr<const Project::Snapshot> mSnapshot;
+    const Project::CancelToken mCancel;
+    const std::shared_ptr<ScanFilesState> mState;
+    const int mChunk;
+};
+
+Set<Symbol> Project::scanFiles(const List<uint32_t> &files, const std::function<void(uint32_t, Set<Symbol> &)> &scan)
+{
+    enum { MinFilesPerChunk = 32 };
+    ThreadPool *pool = Server::instance()->fileScanThreadPool();
+    const int chunks = pool ? std::min(ThreadPool::idealThreadCount(), files.size() / MinFilesPerChunk) : 1;
+    Set<Symbol> ret;
+    if (chunks <= 1) {
+        for (uint32_t file : files) {
+            if (isCancelled())
+                break;
+            scan(file, ret);
+        }
+        return ret;
+    }
+
+    // every chunk reads the same snapshot the calling query does
+    std::shared_ptr<const Snapshot> snapshot;
+    if (sThreadScope && sThreadScope->project == this) {
+        snapshot = sThreadScope->snapshot;
+    } else {
+        snapshot = this->snapshot();
+    }
+    // and stops once the calling query is cancelled
+    const CancelToken cancel = fileMapScope() ? fileMapScope()->cancel : CancelToken();
+    std::shared_ptr<ScanFilesState> state = std::make_shared<ScanFilesState>(files, scan, chunks);
+    for (int chunk=1; chunk<chunks; ++chunk)
+        pool->start(std::make_shared<ScanFilesJob>(this, snapshot, cancel, state, chunk), QueryJob::Priority);
+
+    // chunk 0 runs here, in the caller's scope
+    for (int i=0; i<files.size() && !isCancelled(); i += chunks)
+        scan(files.at(i), state->results[0]);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (state->pending)
+        state->condition.wait(lock);
+
+    FileMapScope *scope = fileMapScope();
+    if (state->allFiles)
+        scope->allFiles = true;
+    for (int chunk=0; chunk<chunks; ++chunk) {
+        if (chunk)
+            scope->files.unite(state->scopeFiles.at(chunk));
+        ret.unite(state->results.at(chunk));
+    }
+    return ret;
+}
+
 static Set<Symbol> findReferences(const Set<Symbol> &inputs,
                                   const std::shared_ptr<Project> &project,
-                                  std::function<bool(const Symbol &, const Symbol &)> filter)
+                                  std::function<bool(const Symbol &, const Symbol &)> filter,
+                                  Project::ReferenceStream *stream = 0)
 {
     Set<Symbol> ret;
     // const bool isClazz = s.isClass();
     for (const Symbol &input : inputs) {
+        if (project->isCancelled())
+            break;
+        if (stream) {
+            if (stream->stopped)
+                break;
+            List<uint32_t> files;
+            if (project->isDeclaration(input.usr)) {
+                files = project->dependencyFiles();
+            } else {
+                files = project->dependencies(input.location.fileId(), Project::DependsOnArg).toList();
+            }
+            const uint32_t first = stream->firstFile;
+            std::sort(files.begin(), files.end(), [first](uint32_t a, uint32_t b) {
+                    return a == first ? b != first : (b != first && a < b);
+                });
+            for (uint32_t dep : files) {
+                if (project->isCancelled())
+                    return ret;
+                auto targets = project->openTargets(dep);
+                if (!targets)
+                    continue;
+                // a Set<Location>, so the file's references come in order
+                for (const auto &loc : targets->value(input.usr)) {
+                    const Symbol sym = project->findSymbol(loc);
+                    if (filter(input, sym) && !(*stream)(sym))
+                        return ret;
+                }
+            }
+            continue;
+        }
         //warning() << "Calling findReferences" << input.location;
-        auto process = [&](uint32_t dep) {
+        auto process = [&project, &filter, &input](uint32_t dep, Set<Symbol> &result) {
             // error() << "Looking at file" << Location::path(dep) << "for input" << input.location;
             auto targets = project->openTargets(dep);
             if (targets) {
@@ -1572,17 +2070,15 @@ static Set<Symbol> findReferences(const Set<Symbol> &inputs,
                 for (const auto &loc : locations) {
                     auto sym = project->findSymbol(loc);
                     if (filter(input, sym))
-                        ret.insert(sym);
+                        result.insert(sym);
                 }
             }
         };
 
         if (project->isDeclaration(input.usr)) {
-            for (auto dep : project->dependencies())
-                process(dep.first);
+            ret.unite(project->scanFiles(project->dependencyFiles(), process));
         } else {
-            for (auto dep : project->dependencies(input.location.fileId(), Project::DependsOnArg))
-                process(dep);
+            ret.unite(project->scanFiles(project->dependencies(input.location.fileId(), Project::DependsOnArg).toList(), process));
         }
 
     }
@@ -1592,7 +2088,8 @@ static Set<Symbol> findReferences(const Set<Symbol> &inputs,
 static Set<Symbol> findReferences(const Symbol &in,
                                   const std::shared_ptr<Project> &project,
                                   std::function<bool(const Symbol &, const Symbol &)> filter,
-                                  Set<Symbol> *inputsPtr = 0)
+                                  Set<Symbol> *inputsPtr = 0,
+                                  Project::ReferenceStream *stream = 0)
 {
     Set<Symbol> inputs;
     Symbol s;
@@ -1632,10 +2129,10 @@ static Set<Symbol> findReferences(const Symbol &in,
     }
     if (inputsPtr)
         *inputsPtr = inputs;
-    return findReferences(inputs, project, filter);
+    return findReferences(inputs, project, filter, stream);
 }
 
-Set<Symbol> Project::findCallers(const Symbol &symbol)
+Set<Symbol> Project::findCallers(const Symbol &symbol, ReferenceStream *stream)
 {
     const bool isClazz = symbol.isClass();
     return ::findReferences(symbol, shared_from_this(), [isClazz](const Symbol &input, const Symbol &ref) {
@@ -1646,10 +2143,10 @@ Set<Symbol> Project::findCallers(const Symbol &symbol)
                 return true;
             }
             return false;
-        });
+        }, 0, stream);
 }
 
-Set<Symbol> Project::findAllReferences(const Symbol &symbol)
+Set<Symbol> Project::findAllReferences(const Symbol &symbol, ReferenceStream *stream)
 {
     if (symbol.isNull())
         return Set<Symbol>();
@@ -1657,15 +2154,31 @@ Set<Symbol> Project::findAllReferences(const Symbol &symbol)
     Set<Symbol> inputs;
     inputs.insert(symbol);
     inputs.unite(findByUsr(symbol.usr, symbol.location.fileId(), DependsOnArg));
+    if (stream) {
+        // the declarations and definitions first, they're already known
+        for (const auto &input : inputs) {
+            if (!(*stream)(input))
+                return Set<Symbol>();
+        }
+    }
     Set<Symbol> ret = inputs;
     for (const auto &input : inputs) {
         Set<Symbol> inputLocations;
         ret.unite(::findReferences(input, shared_from_this(), [](const Symbol &, const Symbol &) {
                     return true;
-                }, &inputLocations));
-        ret.unite(inputLocations);
+                }, &inputLocations, stream));
+        if (stream) {
+            if (stream->stopped)
+                break;
+            for (const auto &loc : inputLocations) {
+                if (!(*stream)(loc))
+                    return Set<Symbol>();
+            }
+        } else {
+            ret.unite(inputLocations);
+        }
     }
-    return ret;
+    return stream ? Set<Symbol>() : ret;
 }
 
 Set<Symbol> Project::findVirtuals(const Symbol &symbol)
@@ -1728,6 +2241,8 @@ Set<Symbol> Project::findSubclasses(const Symbol &symbol)
     assert(symbol.isClass() && symbol.isDefinition());
     Set<Symbol> ret;
     for (uint32_t dep : dependencies(symbol.location.fileId(), DependsOnArg)) {
+        if (isCancelled())
+            break;
         auto symbols = openSymbols(dep);
         if (symbols) {
             const int count = symbols->count();
@@ -1741,16 +2256,42 @@ Set<Symbol> Project::findSubclasses(const Symbol &symbol)
     return ret;
 }
 
-void Project::beginScope()
+thread_local Project::ThreadScope *Project::sThreadScope = 0;
+
+void Project::beginScope(const std::shared_ptr<const Snapshot> &snapshot, const CancelToken &cancel)
 {
-    assert(!mFileMapScope);
-    mFileMapScope.reset(new FileMapScope(shared_from_this(), Server::instance()->options().maxFileMapScopeCacheSize));
+    std::shared_ptr<FileMapScope> scope(new FileMapScope(shared_from_this(), Server::instance()->options().maxFileMapScopeCacheSize));
+    scope->cancel = cancel;
+    if (snapshot) {
+        assert(!sThreadScope);
+        sThreadScope = new ThreadScope;
+        sThreadScope->project = this;
+        sThreadScope->snapshot = snapshot;
+        sThreadScope->fileMapScope = scope;
+    } else {
+        assert(EventLoop::isMainThread());
+        assert(!mFileMapScope);
+        mFileMapScope = scope;
+    }
 }
 
 void Project::endScope()
 {
-    assert(mFileMapScope);
-    mFileMapScope.reset();
+    if (sThreadScope && sThreadScope->project == this) {
+        delete sThreadScope;
+        sThreadScope = 0;
+    } else {
+        assert(mFileMapScope);
+        mFileMapScope.reset();
+    }
+}
+
+Set<uint32_t> Project::scopeFiles(bool *allFiles) const
+{
+    const FileMapScope *scope = fileMapScope();
+    assert(scope);
+    *allFiles = scope->allFiles;
+    return scope->files;
 }
 
 static String addDeps(const Dependencies &deps)
@@ -18,14 +18,17 @@
 
 #include "IndexerJob.h"
 #include "Match.h"
+#include "QueryCache.h"
 #include "QueryMessage.h"
 #include "RTags.h"
 #include "RTagsClang.h"
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <mutex>
 #include <rct/FileSystemWatcher.h>
 #include <rct/EmbeddedLinkedList.h>
+#include <rct/EventLoop.h>
 #include <rct/LinkedList.h>
 #include <rct/Path.h>
 #include <regex>
@@ -34,10 +37,12 @@
 
 class IndexDataMessage;
 class FileManager;
+class PchManager;
 class IndexerJob;
 class RestoreThread;
 class Connection;
 class Dirty;
+class ComplexDirty;
 struct DependencyNode
 {
     DependencyNode(uint32_t f)
@@ -90,23 +95,27 @@ public:
     }
     std::shared_ptr<FileMap<String, Set<Location> > > openSymbolNames(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<String, Set<Location> >(SymbolNames, fileId, mFileMapScope->symbolNames, err);
+        FileMapScope *scope = fileMapScope();
+        assert(scope);
+        return scope->openFileMap<String, Set<Location> >(SymbolNames, fileId, scope->symbolNames, err);
     }
     std::shared_ptr<FileMap<Location, Symbol> > openSymbols(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<Location, Symbol>(Symbols, fileId, mFileMapScope->symbols, err);
+        FileMapScope *scope = fileMapScope();
+        assert(scope);
+        return scope->openFileMap<Location, Symbol>(Symbols, fileId, scope->symbols, err);
     }
     std::shared_ptr<FileMap<String, Set<Location> > > openTargets(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<String, Set<Location> >(Targets, fileId, mFileMapScope->targets, err);
+        FileMapScope *scope = fileMapScope();
+        assert(scope);
+        return scope->openFileMap<String, Set<Location> >(Targets, fileId, scope->targets, err);
     }
     std::shared_ptr<FileMap<String, Set<Location> > > openUsrs(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<String, Set<Location> >(Usrs, fileId, mFileMapScope->usrs, err);
+        FileMapScope *scope = fileMapScope();
+        assert(scope);
+        return scope->openFileMap<String, Set<Location> >(Usrs, fileId, scope->usrs, err);
     }
 
     enum DependencyMode {
@@ -120,8 +129,23 @@ public:
                             const List<String> &args = List<String>(),
                             Flags<QueryMessage::Flag> flags = Flags<QueryMessage::Flag>()) const;
     const Hash<uint32_t, DependencyNode*> &dependencies() const { return mDependencies; }
+    // every file in the dependency graph
+    List<uint32_t> dependencyFiles() const;
     const Declarations &declarations() const { return mDeclarations; }
-    bool isDeclaration(const String &usr) const { return mDeclarations.contains(usr); }
+    bool isDeclaration(const String &usr) const;
+
+    // Immutable view of the metadata queries read. Queries on the query
+    // thread pool see this instead of the live project, see beginScope().
+    struct Snapshot {
+        struct Node {
+            Set<uint32_t> includes, dependents;
+        };
+        Hash<uint32_t, std::shared_ptr<const Node> > dependencies; // nodes are shared between snapshots
+        Set<String> declarations; // usrs that have a declaration
+    };
+    // shared until the dependencies or declarations change, after that only
+    // the nodes and usrs that changed are rebuilt
+    std::shared_ptr<const Snapshot> snapshot();
 
     static bool readSources(const Path &path, Sources &sources, String *error);
     enum SymbolMatchType {
@@ -144,16 +168,39 @@ public:
     Set<Symbol> findTargets(const Symbol &symbol);
     Symbol findTarget(const Location &location) { return RTags::bestTarget(findTargets(location)); }
     Symbol findTarget(const Symbol &symbol) { return RTags::bestTarget(findTargets(symbol)); }
+    // Takes references one at a time as they're found instead of collecting
+    // them. Files are searched in order, firstFile first and then by fileId,
+    // and the search stops once func returns false.
+    struct ReferenceStream {
+        ReferenceStream(uint32_t first, const std::function<bool(const Symbol &)> &f)
+            : firstFile(first), func(f), stopped(false)
+        {}
+
+        bool operator()(const Symbol &symbol)
+        {
+            if (!stopped && !func(symbol))
+                stopped = true;
+            return !stopped;
+        }
+
+        const uint32_t firstFile;
+        const std::function<bool(const Symbol &)> func;
+        bool stopped;
+    };
     Set<Symbol> findAllReferences(const Location &location) { return findAllReferences(findSymbol(location)); }
-    Set<Symbol> findAllReferences(const Symbol &symbol);
+    Set<Symbol> findAllReferences(const Symbol &symbol, ReferenceStream *stream = 0);
     Set<Symbol> findCallers(const Location &location) { return findCallers(findSymbol(location)); }
-    Set<Symbol> findCallers(const Symbol &symbol);
+    Set<Symbol> findCallers(const Symbol &symbol, ReferenceStream *stream = 0);
     Set<Symbol> findVirtuals(const Location &location) { return findVirtuals(findSymbol(location)); }
     Set<Symbol> findVirtuals(const Symbol &symbol);
     Set<String> findTargetUsrs(const Location &loc);
     Set<Symbol> findSubclasses(const Symbol &symbol);
 
     Set<Symbol> findByUsr(const String &usr, uint32_t fileId, DependencyMode mode);
+    // Calls scan for each file. Large lists are split in chunks that run on
+    // the server's file scan thread pool, each in a scope of its own over the
+    // caller's snapshot, and their results are merged.
+    Set<Symbol> scanFiles(const List<uint32_t> &files, const std::function<void(uint32_t, Set<Symbol> &)> &scan);
 
     Path sourceFilePath(uint32_t fileId, const char *path = "") const;
 
@@ -174,7 +221,10 @@ public:
     List<Source> sources(uint32_t fileId) const;
     bool hasSource(uint32_t fileId) const;
     bool isActiveJob(uint64_t key) { return !key || mActiveJobs.contains(key); }
-    inline bool visitFile(uint32_t fileId, const Path &path, uint64_t id);
+    IndexCost indexCost(uint64_t key) const { return mIndexCosts.value(key); }
+    // source must have been passed through IndexerJob::prepareSource
+    Path pch(const Source &source) const;
+    inline bool visitFile(uint32_t fileId, uint64_t id);
     inline void releaseFileIds(const Set<uint32_t> &fileIds);
     String fixIts(uint32_t fileId) const;
     int reindex(const Match &match,
@@ -199,19 +249,37 @@ public:
     void onFileModified(const Path &path);
     void onFileRemoved(const Path &path);
     void dumpFileMaps(const std::shared_ptr<QueryMessage> &msg, const std::shared_ptr<Connection> &conn);
-    Hash<uint32_t, Path> visitedFiles() const
+    Set<uint32_t> visitedFiles() const
     {
         std::lock_guard<std::mutex> lock(mMutex);
         return mVisitedFiles;
     }
     void encodeVisitedFiles(Serializer &serializer)
     {
-        std::lock_guard<std::mutex> lock(mMutex);
-        serializer << mVisitedFiles;
+        Hash<uint32_t, Path> visited;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (uint32_t fileId : mVisitedFiles)
+                visited[fileId] = Location::path(fileId);
+        }
+        serializer << visited;
     }
 
-    void beginScope();
+    // With a snapshot the scope belongs to the calling thread and the
+    // project's queries read the snapshot until endScope(). Once cancel is
+    // set the project's lookups in the scope stop early, see isCancelled().
+    typedef std::shared_ptr<const std::atomic<bool> > CancelToken;
+    void beginScope(const std::shared_ptr<const Snapshot> &snapshot = std::shared_ptr<const Snapshot>(),
+                    const CancelToken &cancel = CancelToken());
     void endScope();
+    bool isCancelled() const
+    {
+        const FileMapScope *scope = fileMapScope();
+        return scope && scope->cancel && *scope->cancel;
+    }
+    // the files the current scope has read, *allFiles is set if it walked all of them
+    Set<uint32_t> scopeFiles(bool *allFiles) const;
+    QueryCache &queryCache() { return mQueryCache; }
     void dirty(uint32_t fileId);
     bool save();
     void prepare(uint32_t fileId);
@@ -227,14 +295,39 @@ private:
     void updateDeclarations(const Set<uint32_t> &visited, Declarations &declarations);
     void loadFailed(uint32_t fileId);
     void updateFixIts(const Set<uint32_t> &visited, FixIts &fixIts);
+    void loadDiagnostics(uint32_t fileId);
+    bool saveDiagnostics(uint32_t fileId);
+    List<Source> dirtySources(Dirty *dirty) const;
     int startDirtyJobs(Dirty *dirty,
                        const UnsavedFiles &unsavedFiles = UnsavedFiles(),
                        const std::shared_ptr<Connection> &wait = std::shared_ptr<Connection>());
+    void startContentCheckedDirtyJobs(const std::shared_ptr<ComplexDirty> &dirty);
+
+    // Startup staleness check. The sources are split into batches and the
+    // files each batch depends on are stat'ed on StatThreads. A batch's
+    // dirty jobs are started once it and all batches before it are done.
+    struct StalenessScan {
+        struct Batch {
+            Batch() : done(false) {}
+            Set<uint32_t> sources, dependencies;
+            Hash<uint32_t, Path> files; // the dependencies no earlier batch stats
+            bool done;
+        };
+        StalenessScan() : started(0), finished(0), running(0) {}
+        List<Batch> batches;
+        Hash<uint32_t, uint64_t> lastModified;
+        Set<uint32_t> dirty;
+        int started, finished, running;
+    };
+    void startStalenessScan(const Set<uint32_t> &dirty);
+    void startStatThreads(const std::shared_ptr<StalenessScan> &scan);
+    void onStatThreadFinished(const std::shared_ptr<StalenessScan> &scan, int idx,
+                              const Hash<uint32_t, uint64_t> &lastModified);
     void onDirtyTimeout(Timer *);
 
     struct FileMapScope {
         FileMapScope(const std::shared_ptr<Project> &proj, int m)
-            : project(proj), openedFiles(0), max(m)
+            : project(proj), openedFiles(0), max(m), allFiles(false)
         {}
 
         struct LRUKey {
@@ -268,6 +361,7 @@ private:
                                                           Hash<uint32_t, std::shared_ptr<FileMap<Key, Value> > > &cache,
                                                           String *errPtr)
         {
+            files.insert(fileId);
             auto it = cache.find(fileId);
             if (it != cache.end()) {
                 poke(type, fileId);
@@ -312,7 +406,15 @@ private:
                 } else {
                     error() << "Failed to open" << path << Location::path(fileId) << err;
                 }
-                project->loadFailed(fileId);
+                if (EventLoop::isMainThread()) {
+                    project->loadFailed(fileId);
+                } else {
+                    std::weak_ptr<Project> weak = project;
+                    EventLoop::mainEventLoop()->callLater([weak, fileId]() {
+                            if (std::shared_ptr<Project> proj = weak.lock())
+                                proj->loadFailed(fileId);
+                        });
+                }
                 fileMap.reset();
             }
             return fileMap;
@@ -324,6 +426,9 @@ private:
         std::shared_ptr<Project> project;
         int openedFiles;
         const int max;
+        Set<uint32_t> files;
+        bool allFiles;
+        CancelToken cancel;
 
         EmbeddedLinkedList<std::shared_ptr<LRUEntry> > entryList;
         Map<LRUKey, std::shared_ptr<LRUEntry> > entryMap;
@@ -331,15 +436,37 @@ private:
 
     std::shared_ptr<FileMapScope> mFileMapScope;
 
+    struct ThreadScope {
+        const Project *project;
+        std::shared_ptr<const Snapshot> snapshot;
+        std::shared_ptr<FileMapScope> fileMapScope;
+    };
+    static thread_local ThreadScope *sThreadScope;
+    const Snapshot *threadSnapshot() const
+    {
+        return sThreadScope && sThreadScope->project == this ? sThreadScope->snapshot.get() : 0;
+    }
+    FileMapScope *fileMapScope() const
+    {
+        if (sThreadScope && sThreadScope->project == this)
+            return sThreadScope->fileMapScope.get();
+        return mFileMapScope.get();
+    }
+    std::shared_ptr<Snapshot> mSnapshot; // null means rebuild from scratch
+    // what changed since mSnapshot was taken
+    Set<uint32_t> mSnapshotFiles;
+    Set<String> mSnapshotUsrs;
+
     const Path mPath, mSourceFilePathBase;
     Path mProjectFilePath, mSourcesFilePath;
 
     Files mFiles;
 
-    Hash<uint32_t, Path> mVisitedFiles;
+    Set<uint32_t> mVisitedFiles;
     int mJobCounter, mJobsStarted;
 
-    Diagnostics mDiagnostics;
+    // keyed on fileId, stored in sourceFilePath(fileId, "diagnostics")
+    Map<uint32_t, Diagnostics> mDiagnostics;
 
     // key'ed on Source::key()
     Hash<uint64_t, std::shared_ptr<IndexerJob> > mActiveJobs;
@@ -347,10 +474,17 @@ private:
     Timer mDirtyTimer;
     Set<uint32_t> mPendingDirtyFiles;
 
+    // content hashes of visited files, see startContentCheckedDirtyJobs()
+    Hash<uint32_t, RTags::FileHash> mFileHashes;
+
     StopWatch mTimer;
     FileSystemWatcher mWatcher;
     Declarations mDeclarations;
     Sources mSources;
+    // key'ed on Source::key()
+    Hash<uint64_t, IndexCost> mIndexCosts;
+    std::shared_ptr<PchManager> mPch;
+    QueryCache mQueryCache;
     Hash<Path, Flags<WatchMode> > mWatchedPaths;
     std::shared_ptr<FileManager> mFileManager;
     FixIts mFixIts;
@@ -363,13 +497,11 @@ private:
 
 RCT_FLAGS(Project::WatchMode);
 
-inline bool Project::visitFile(uint32_t visitFileId, const Path &path, uint64_t key)
+inline bool Project::visitFile(uint32_t visitFileId, uint64_t key)
 {
     std::lock_guard<std::mutex> lock(mMutex);
     assert(visitFileId);
-    Path &p = mVisitedFiles[visitFileId];
-    if (p.isEmpty()) {
-        p = path;
+    if (mVisitedFiles.insert(visitFileId)) {
         if (key) {
             assert(mActiveJobs.contains(key));
             std::shared_ptr<IndexerJob> &job = mActiveJobs[key];
@@ -0,0 +1,118 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "QueryCache.h"
+#include "QueryMessage.h"
+#include <rct/Serializer.h>
+
+QueryCache::QueryCache()
+    : mGeneration(0), mTick(0), mHits(0), mMisses(0), mStale(0)
+{
+}
+
+String QueryCache::key(const QueryMessage &query)
+{
+    if (!query.unsavedFiles().isEmpty())
+        return String();
+    switch (query.type()) {
+    case QueryMessage::FollowLocation:
+    case QueryMessage::SymbolInfo:
+    case QueryMessage::ReferencesLocation:
+    case QueryMessage::ReferencesName:
+    case QueryMessage::FileSymbols:
+        break;
+    default:
+        return String();
+    }
+    String ret;
+    Serializer serializer(ret);
+    serializer << query.query() << query.type() << query.flags() << query.max()
+               << query.minLine() << query.maxLine() << query.buildIndex() << query.pathFilters()
+               << query.kindFilters() << query.currentFile() << query.terminalWidth();
+    return ret;
+}
+
+bool QueryCache::isValid(const Entry &entry) const
+{
+    if (entry.allFiles)
+        return entry.generation == mGeneration;
+    for (uint32_t file : entry.files) {
+        if (mFileGenerations.value(file) > entry.generation)
+            return false;
+    }
+    return true;
+}
+
+bool QueryCache::lookup(const String &key, List<String> &output, int &ret)
+{
+    auto it = mEntries.find(key);
+    if (it == mEntries.end()) {
+        ++mMisses;
+        return false;
+    }
+    if (!isValid(it->second)) {
+        ++mStale;
+        mLRU.remove(it->second.tick);
+        mEntries.erase(it);
+        return false;
+    }
+    ++mHits;
+    mLRU.remove(it->second.tick);
+    it->second.tick = ++mTick;
+    mLRU[it->second.tick] = key;
+    output = it->second.output;
+    ret = it->second.ret;
+    return true;
+}
+
+void QueryCache::insert(const String &key, uint64_t generation, const Set<uint32_t> &files, bool allFiles,
+                        const List<String> &output, int ret)
+{
+    Entry &entry = mEntries[key];
+    if (entry.tick)
+        mLRU.remove(entry.tick);
+    entry.generation = generation;
+    entry.tick = ++mTick;
+    entry.files = files;
+    // a query that read no files may have failed because they weren't indexed yet
+    entry.allFiles = allFiles || files.isEmpty();
+    entry.output = output;
+    entry.ret = ret;
+    mLRU[entry.tick] = key;
+    if (!isValid(entry)) { // something was reindexed while the query ran
+        mLRU.remove(entry.tick);
+        mEntries.remove(key);
+        return;
+    }
+
+    while (mEntries.size() > MaxEntries) {
+        auto first = mLRU.begin();
+        mEntries.remove(first->second);
+        mLRU.erase(first);
+    }
+}
+
+void QueryCache::invalidate(const Set<uint32_t> &files)
+{
+    ++mGeneration;
+    for (uint32_t file : files)
+        mFileGenerations[file] = mGeneration;
+}
+
+void QueryCache::clear()
+{
+    mEntries.clear();
+    mLRU.clear();
+}
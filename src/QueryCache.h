@@ -0,0 +1,76 @@
+/* This file is part of RTags (http://rtags.net).
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef QueryCache_h
+#define QueryCache_h
+
+#include <rct/Hash.h>
+#include <rct/List.h>
+#include <rct/Map.h>
+#include <rct/Set.h>
+#include <rct/String.h>
+#include <cstdint>
+
+class QueryMessage;
+
+// Output of finished queries, reused for identical queries until one of the
+// files the query read is reindexed. Every invalidation bumps the project's
+// generation and stamps the files it covers with it, an entry is stale once
+// a file it read has a newer stamp than the entry. Queries that walked every
+// file in the project are stale after any invalidation. Only used on the main
+// thread.
+class QueryCache
+{
+public:
+    QueryCache();
+
+    // empty for queries whose results aren't cached
+    static String key(const QueryMessage &query);
+
+    bool lookup(const String &key, List<String> &output, int &ret);
+    void insert(const String &key, uint64_t generation, const Set<uint32_t> &files, bool allFiles,
+                const List<String> &output, int ret);
+    void invalidate(const Set<uint32_t> &files);
+    void invalidate(uint32_t file)
+    {
+        mFileGenerations[file] = ++mGeneration;
+    }
+    void clear();
+
+    uint64_t generation() const { return mGeneration; }
+    int hits() const { return mHits; }
+    int misses() const { return mMisses; }
+    int stale() const { return mStale; }
+    int size() const { return mEntries.size(); }
+private:
+    enum { MaxEntries = 256 };
+    struct Entry {
+        Entry() : generation(0), tick(0), allFiles(false), ret(0) {}
+        uint64_t generation, tick;
+        Set<uint32_t> files;
+        bool allFiles;
+        List<String> output;
+        int ret;
+    };
+    bool isValid(const Entry &entry) const;
+
+    Hash<String, Entry> mEntries;
+    Map<uint64_t, String> mLRU; // tick -> key
+    Hash<uint32_t, uint64_t> mFileGenerations;
+    uint64_t mGeneration, mTick;
+    int mHits, mMisses, mStale;
+};
+
+#endif
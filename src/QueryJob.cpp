@@ -16,6 +16,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "QueryJob.h"
 #include "RTags.h"
 #include <rct/EventLoop.h>
+#include <rct/Rct.h>
 #include "Server.h"
 #include <regex>
 #include "QueryMessage.h"
@@ -24,10 +25,8 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 QueryJob::QueryJob(const std::shared_ptr<QueryMessage> &query,
                    const std::shared_ptr<Project> &proj,
                    Flags<JobFlag> jobFlags)
-    : mAborted(false), mLinesWritten(0), mQueryMessage(query), mJobFlags(jobFlags), mProject(proj), mFileFilter(0)
+    : mAborted(std::make_shared<std::atomic<bool> >(false)), mLinesWritten(0), mQueryMessage(query), mJobFlags(jobFlags), mProject(proj), mRecordOutput(false), mAllFiles(false), mFileFilter(0), mBufferTime(0), mParent(0)
 {
-    if (mProject)
-        mProject->beginScope();
     assert(query);
     if (query->flags() & QueryMessage::SilentQuery)
         setJobFlag(QuietJob);
@@ -55,30 +54,61 @@ QueryJob::QueryJob(const std::shared_ptr<QueryMessage> &query,
 
 QueryJob::~QueryJob()
 {
-    if (mProject)
-        mProject->endScope();
+}
+
+static inline void appendVarint(String &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+static inline void appendString(String &out, const String &string)
+{
+    appendVarint(out, string.size());
+    out.append(string);
+}
+
+static inline void appendLocation(String &out, const Location &location)
+{
+    appendVarint(out, location.fileId());
+    appendVarint(out, location.line());
+    appendVarint(out, location.column());
+}
+
+String QueryJob::textRecord(const String &text)
+{
+    String out;
+    appendVarint(out, text.size() + 1);
+    out.append(static_cast<char>(TextRecord));
+    out.append(text);
+    return out;
 }
 
 bool QueryJob::write(const String &out, Flags<WriteFlag> flags)
 {
     if ((mJobFlags & WriteUnfiltered) || (flags & Unfiltered) || filter(out)) {
-        if ((mJobFlags & QuoteOutput) && !(flags & DontQuote)) {
-            String o((out.size() * 2) + 2, '"');
-            char *ch = o.data() + 1;
-            int l = 2;
+        if (queryFlags() & QueryMessage::Binary) {
+            String record;
+            record.append(static_cast<char>(TextRecord));
+            record.append(out);
+            return writeRecord(0, record, flags);
+        } else if ((mJobFlags & QuoteOutput) && !(flags & DontQuote)) {
+            // quoted into a buffer that's reused for every line
+            mQuoted.resize((out.size() * 2) + 2);
+            char *ch = mQuoted.data();
+            *ch++ = '"';
             for (int i=0; i<out.size(); ++i) {
                 const char c = out.at(i);
-                if (c == '"') {
-                    *ch = '\\';
-                    ch += 2;
-                    l += 2;
-                } else {
-                    ++l;
-                    *ch++ = c;
-                }
+                if (c == '"')
+                    *ch++ = '\\';
+                *ch++ = c;
             }
-            o.truncate(l);
-            return writeRaw(o, flags);
+            *ch++ = '"';
+            mQuoted.truncate(ch - mQuoted.data());
+            return writeRaw(mQuoted, flags);
         } else {
             return writeRaw(out, flags);
         }
@@ -86,9 +116,27 @@ bool QueryJob::write(const String &out, Flags<WriteFlag> flags)
     return true;
 }
 
+bool QueryJob::writeRecord(uint32_t fileId, const String &record, Flags<WriteFlag> flags)
+{
+    // the path table belongs to the stream, nested jobs share their parent's
+    QueryJob *stream = mParent ? mParent : this;
+    String out;
+    if (fileId && stream->mBinaryPaths.insert(fileId)) {
+        String path;
+        path.append(static_cast<char>(PathRecord));
+        appendVarint(path, fileId);
+        appendString(path, Location::path(fileId));
+        appendVarint(out, path.size());
+        out.append(path);
+    }
+    appendVarint(out, record.size());
+    out.append(record);
+    return writeRaw(out, flags);
+}
+
 bool QueryJob::writeRaw(const String &out, Flags<WriteFlag> flags)
 {
-    assert(mConnection);
+    assert(mConnection || mParent);
     if (!(flags & IgnoreMax) && mQueryMessage) {
         const int max = mQueryMessage->max();
         if (max != -1 && mLinesWritten == max) {
@@ -98,17 +146,57 @@ bool QueryJob::writeRaw(const String &out, Flags<WriteFlag> flags)
         ++mLinesWritten;
     }
 
-    if (!(mJobFlags & QuietJob))
+    if (mParent)
+        return mParent->writeRaw(out, flags | IgnoreMax);
+
+    const bool binary = queryFlags() & QueryMessage::Binary;
+    if (!(mJobFlags & QuietJob) && !binary)
         error("=> %s", out.constData());
 
-    if (mConnection) {
-        if (!mConnection->write(out)) {
-            abort();
-            return false;
-        }
+    // empty responses never made it to rc's output, don't add empty lines
+    if (out.isEmpty())
         return true;
+
+    if (mRecordOutput)
+        mRecordedOutput.append(out);
+
+    if (!mConnection)
+        return true;
+
+    const uint64_t now = Rct::currentTimeMs();
+    if (mBuffer.isEmpty()) {
+        mBufferTime = now;
+    } else if (!binary) {
+        mBuffer.append('\n');
     }
+    mBuffer.append(out);
+    if (flags & Flush || mBuffer.size() >= FrameSize || now - mBufferTime >= FrameLatency)
+        return flush();
+    return !isAborted();
+}
 
+bool QueryJob::flush()
+{
+    if (!mConnection || mBuffer.isEmpty())
+        return true;
+
+    String frame = std::move(mBuffer);
+    mBuffer.clear();
+    mBuffer.reserve(FrameSize);
+    if (!EventLoop::isMainThread()) {
+        // we're on the query thread pool, the connection belongs to the main thread
+        std::weak_ptr<Connection> conn = mConnection;
+        EventLoop::mainEventLoop()->callLater([conn, frame]() {
+                if (std::shared_ptr<Connection> c = conn.lock())
+                    c->write(frame);
+            });
+        return !isAborted();
+    }
+
+    if (!mConnection->write(frame)) {
+        abort();
+        return false;
+    }
     return true;
 }
 
@@ -121,6 +209,22 @@ bool QueryJob::write(const Location &location, Flags<WriteFlag> flags)
             return false;
         flags |= Unfiltered;
     }
+    if (queryFlags() & QueryMessage::Binary) {
+        CXCursorKind kind = CXCursor_FirstInvalid;
+        if (!mKindFilters.isEmpty() || queryFlags() & QueryMessage::CursorKind) {
+            const Symbol symbol = project()->findSymbol(location);
+            if (!symbol.isNull()) {
+                if (!filterKind(symbol.kind))
+                    return false;
+                kind = symbol.kind;
+            }
+        }
+        String record;
+        record.append(static_cast<char>(LocationRecord));
+        appendLocation(record, location);
+        appendVarint(record, kind);
+        return writeRecord(location.fileId(), record, flags);
+    }
     String out = location.key(keyFlags());
     const bool containingFunction = queryFlags() & QueryMessage::ContainingFunction;
     const bool cursorKind = queryFlags() & QueryMessage::CursorKind;
@@ -175,6 +279,18 @@ bool QueryJob::write(const Symbol &symbol,
     if (!filterKind(symbol.kind))
         return false;
 
+    if (queryFlags() & QueryMessage::Binary) {
+        String record;
+        record.append(static_cast<char>(SymbolRecord));
+        appendLocation(record, symbol.location);
+        appendVarint(record, symbol.kind);
+        appendVarint(record, symbol.symbolLength);
+        appendVarint(record, symbol.isDefinition());
+        appendString(record, symbol.symbolName);
+        appendString(record, symbol.typeName);
+        return writeRecord(symbol.location.fileId(), record, writeFlags);
+    }
+
     return write(symbol.toString(toStringFlags, keyFlags(), project()), writeFlags|Unfiltered);
 }
 
@@ -216,11 +332,28 @@ int QueryJob::run(const std::shared_ptr<Connection> &connection)
 {
     assert(connection);
     mConnection = connection;
+    if (mProject)
+        mProject->beginScope(mSnapshot, mAborted);
     const int ret = execute();
+    flush();
+    if (mProject) {
+        if (mRecordOutput)
+            mRecordedFiles = mProject->scopeFiles(&mAllFiles);
+        mProject->endScope();
+    }
     mConnection = 0;
     return ret;
 }
 
+int QueryJob::runNested(QueryJob *parent)
+{
+    assert(parent && parent->project() == mProject);
+    mParent = parent;
+    const int ret = execute();
+    mParent = 0;
+    return ret;
+}
+
 bool QueryJob::filterLocation(const Location &loc) const
 {
     if (mFileFilter && loc.fileId() != mFileFilter)
@@ -24,6 +24,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include <regex>
 #include "RTagsClang.h"
 #include "QueryMessage.h"
+#include <atomic>
 #include <mutex>
 #include <rct/Flags.h>
 #include "Project.h"
@@ -60,8 +61,22 @@ public:
         NoWriteFlags = 0x0,
         IgnoreMax = 0x1,
         DontQuote = 0x2,
-        Unfiltered = 0x4
+        Unfiltered = 0x4,
+        Flush = 0x8 // send it now instead of waiting for the frame to fill up
     };
+    // With QueryMessage::Binary the output is a stream of records instead of
+    // lines. Each is a varint length followed by the record type and its
+    // fields, integers as varints and strings as a varint length and the
+    // bytes. A PathRecord maps a fileId to its path before the first record
+    // that uses it.
+    enum BinaryRecord {
+        PathRecord = 1, // fileId, path
+        LocationRecord = 2, // fileId, line, column, kind
+        SymbolRecord = 3, // fileId, line, column, kind, length, definition, name, type
+        TextRecord = 4 // text
+    };
+    // a whole TextRecord, for output that doesn't come from a job
+    static String textRecord(const String &text);
     bool write(const String &out, Flags<WriteFlag> flags = Flags<WriteFlag>());
     bool write(const Symbol &symbol,
                Flags<Symbol::ToStringFlag> sourceFlags = Flags<Symbol::ToStringFlag>(),
@@ -79,12 +94,24 @@ public:
     bool filter(const String &val) const;
     Signal<std::function<void(const String &)> > &output() { return mOutput; }
     std::shared_ptr<Project> project() const { return mProject; }
+    // run against this snapshot of the project, for jobs on the query thread pool
+    void setSnapshot(const std::shared_ptr<const Project::Snapshot> &snapshot) { mSnapshot = snapshot; }
+    // keep the output and the files the job read, for the project's query cache
+    void setRecordOutput(bool on) { mRecordOutput = on; }
+    const List<String> &recordedOutput() const { return mRecordedOutput; }
+    const Set<uint32_t> &recordedFiles(bool *allFiles) const { *allFiles = mAllFiles; return mRecordedFiles; }
     virtual int execute() = 0;
     int run(const std::shared_ptr<Connection> &connection = 0);
-    bool isAborted() const { std::lock_guard<std::mutex> lock(mMutex); return mAborted; }
-    void abort() { std::lock_guard<std::mutex> lock(mMutex); mAborted = true; }
+    // runs inside parent's run(), in its scope and writing to its output
+    int runNested(QueryJob *parent);
+    // Set when the client goes away or the query is superseded. The project's
+    // lookups check it too, see Project::isCancelled().
+    bool isAborted() const { return *mAborted; }
+    void abort() { *mAborted = true; }
     std::mutex &mutex() const { return mMutex; }
     const std::shared_ptr<Connection> &connection() const { return mConnection; }
+    // sends the buffered output, call before writing to connection() directly
+    bool flush();
 private:
     class Filter
     {
@@ -122,18 +149,34 @@ private:
     bool filterLocation(const Location &loc) const;
     bool filterKind(CXCursorKind kind) const;
     mutable std::mutex mMutex;
-    bool mAborted;
+    const std::shared_ptr<std::atomic<bool> > mAborted;
     int mLinesWritten;
     bool writeRaw(const String &out, Flags<WriteFlag> flags);
+    bool writeRecord(uint32_t fileId, const String &record, Flags<WriteFlag> flags);
+    // Output lines are joined with '\n' and sent as one response once the
+    // frame is this big or its first line this old (in ms). The age is only
+    // checked when another line is written, use Flush for output that has
+    // to go out while the job is still busy.
+    enum {
+        FrameSize = 64 * 1024,
+        FrameLatency = 50
+    };
     std::shared_ptr<QueryMessage> mQueryMessage;
     Flags<JobFlag> mJobFlags;
     Signal<std::function<void(const String &)> > mOutput;
     std::shared_ptr<Project> mProject;
+    std::shared_ptr<const Project::Snapshot> mSnapshot;
+    bool mRecordOutput, mAllFiles;
+    List<String> mRecordedOutput;
+    Set<uint32_t> mRecordedFiles;
     uint32_t mFileFilter;
     List<std::shared_ptr<Filter> > mFilters;
     Set<String> mKindFilters;
-    String mBuffer;
+    String mBuffer, mQuoted;
+    uint64_t mBufferTime;
     std::shared_ptr<Connection> mConnection;
+    QueryJob *mParent;
+    Set<uint32_t> mBinaryPaths; // fileIds with a PathRecord written
 };
 
 RCT_FLAGS(QueryJob::JobFlag);
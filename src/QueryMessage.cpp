@@ -22,18 +22,44 @@ QueryMessage::QueryMessage(Type type)
 {
 }
 
+List<QueryMessage::SubQuery> QueryMessage::subQueries() const
+{
+    assert(mType == Batch);
+    List<SubQuery> ret;
+    Deserializer deserializer(mQuery);
+    deserializer >> ret;
+    return ret;
+}
+
+void QueryMessage::setSubQueries(const List<SubQuery> &subQueries)
+{
+    assert(mType == Batch);
+    mQuery.clear();
+    Serializer serializer(mQuery);
+    serializer << subQueries;
+}
+
+std::shared_ptr<QueryMessage> QueryMessage::subQuery(const SubQuery &sub) const
+{
+    std::shared_ptr<QueryMessage> ret = std::make_shared<QueryMessage>(*this);
+    ret->mType = sub.type;
+    ret->mQuery = sub.query;
+    ret->mFlags |= sub.flags | HasLocation;
+    return ret;
+}
+
 void QueryMessage::encode(Serializer &serializer) const
 {
     serializer << mRaw << mQuery << mType << mFlags << mMax
                << mMinLine << mMaxLine << mBuildIndex << mPathFilters << mKindFilters
-               << mCurrentFile << mUnsavedFiles << mTerminalWidth;
+               << mCurrentFile << mUnsavedFiles << mTerminalWidth << mClientTag;
 }
 
 void QueryMessage::decode(Deserializer &deserializer)
 {
     deserializer >> mRaw >> mQuery >> mType >> mFlags >> mMax
                  >> mMinLine >> mMaxLine >> mBuildIndex >> mPathFilters >> mKindFilters
-                 >> mCurrentFile >> mUnsavedFiles >> mTerminalWidth;
+                 >> mCurrentFile >> mUnsavedFiles >> mTerminalWidth >> mClientTag;
 }
 
 Flags<Location::KeyFlag> QueryMessage::keyFlags(Flags<Flag> queryFlags)
@@ -111,6 +137,10 @@ QueryMessage::Flag QueryMessage::flagFromString(const String &string)
         return SynchronousCompletions;
     } else if (string == "no-sort-references-by-input") {
         return NoSortReferencesByInput;
+    } else if (string == "stream-references") {
+        return StreamReferences;
+    } else if (string == "binary") {
+        return Binary;
     } else if (string == "has-location") {
         return HasLocation;
     } else if (string == "wildcard-symbol-names") {
@@ -32,6 +32,7 @@ public:
     enum Type {
         Invalid,
         GenerateTest,
+        Batch,
         CheckReindex,
         ClassHierarchy,
         ClearProjects,
@@ -43,6 +44,8 @@ public:
         DumpCompletions,
         DumpFile,
         DumpFileMaps,
+        Export,
+        FileSymbols,
         FindFile,
         FindSymbols,
         FixIts,
@@ -103,7 +106,9 @@ public:
         NoColor = 0x040000000,
         Rename = 0x080000000,
         ContainingFunction = 0x100000000,
-        Wait = 0x200000000
+        Wait = 0x200000000,
+        StreamReferences = 0x400000000,
+        Binary = 0x800000000
     };
 
     QueryMessage(Type type = Invalid);
@@ -132,6 +137,17 @@ public:
         std::sort(mPathFilters.begin(), mPathFilters.end());
     }
 
+    // One query of a Batch. A batch's query() holds its sub queries
+    // serialized, they share its filters, max and current file.
+    struct SubQuery {
+        Type type;
+        String query;
+        Flags<Flag> flags;
+    };
+    List<SubQuery> subQueries() const;
+    void setSubQueries(const List<SubQuery> &subQueries);
+    std::shared_ptr<QueryMessage> subQuery(const SubQuery &sub) const;
+
     void setKindFilters(const Set<String> &kindFilters) { mKindFilters = kindFilters; }
     const Set<String> &kindFilters() const { return mKindFilters; }
 
@@ -192,6 +208,10 @@ public:
 
     void setCurrentFile(const Path &currentFile) { mCurrentFile = currentFile; }
     Path currentFile() const { return mCurrentFile; }
+
+    // a new query with the same tag cancels the one still running
+    void setClientTag(const String &clientTag) { mClientTag = clientTag; }
+    const String &clientTag() const { return mClientTag; }
 private:
     String mQuery;
     Type mType;
@@ -202,6 +222,7 @@ private:
     Path mCurrentFile;
     UnsavedFiles mUnsavedFiles;
     int mTerminalWidth;
+    String mClientTag;
 };
 
 inline Serializer &operator<<(Serializer &s, const QueryMessage::PathFilter &filter)
@@ -222,4 +243,16 @@ RCT_FLAGS(QueryMessage::Flag);
 
 DECLARE_NATIVE_TYPE(QueryMessage::Type);
 
+inline Serializer &operator<<(Serializer &s, const QueryMessage::SubQuery &sub)
+{
+    s << sub.type << sub.query << sub.flags;
+    return s;
+}
+
+inline Deserializer &operator>>(Deserializer &s, QueryMessage::SubQuery &sub)
+{
+    s >> sub.type >> sub.query >> sub.flags;
+    return s;
+}
+
 #endif // QUERYMESSAGE_H
@@ -86,6 +86,8 @@ struct Option opts[] = {
     { RClient::CheckReindex, "check-reindex", 'x', optional_argument, "Check if reindexing is necessary for all files matching pattern." },
     { RClient::FindFile, "path", 'P', optional_argument, "Print files matching pattern." },
     { RClient::DumpFile, "dump-file", 'd', required_argument, "Dump source file." },
+    { RClient::FileSymbols, "file-symbols", 0, required_argument, "List the symbols in file, limited to --range-filter's lines: line:col, length, kind, definition and target kind." },
+    { RClient::Export, "export", 0, optional_argument, "Export every symbol of the project as a line of JSON per symbol, files in fileId order. Start at the fileId given as argument and limit the number of files with --max." },
     { RClient::DumpFileMaps, "dump-file-maps", 0, required_argument, "Dump file maps for file." },
     { RClient::GenerateTest, "generate-test", 0, required_argument, "Generate a test for a given source file." },
     { RClient::RdmLog, "rdm-log", 'g', no_argument, "Receive logs from rdm." },
@@ -107,6 +109,7 @@ struct Option opts[] = {
     { RClient::SetBuffers, "set-buffers", 0, optional_argument, "Set active buffers (list of filenames for active buffers in editor)." },
     { RClient::ListBuffers, "list-buffers", 0, no_argument, "List active buffers." },
     { RClient::ClassHierarchy, "class-hierarchy", 0, required_argument, "Dump class hierarcy for struct/class at location." },
+    { RClient::Batch, "batch", 0, no_argument, "Read queries from stdin, one per line: follow-location|symbol-info|references|class-hierarchy file:line:col [flag...]. Each query's output is followed by a line with \\x1e, its index and return code. All the locations have to be in the same project." },
 
     { RClient::None, 0, 0, 0, "" },
     { RClient::None, 0, 0, 0, "Command flags:" },
@@ -138,6 +141,7 @@ struct Option opts[] = {
     { RClient::CursorKind, "cursor-kind", 0, no_argument, "Include cursor kind in --find-symbols output." },
     { RClient::DisplayName, "display-name", 0, no_argument, "Include display name in --find-symbols output." },
     { RClient::CurrentFile, "current-file", 0, required_argument, "Pass along which file is being edited to give rdm a better chance at picking the right project." },
+    { RClient::ClientTag, "client-tag", 0, required_argument, "Tag the query, rdm cancels a query that's still running when a new one with the same tag arrives." },
     { RClient::DeclarationOnly, "declaration-only", 0, no_argument, "Filter out definitions (unless inline).", },
     { RClient::DefinitionOnly, "definition-only", 0, no_argument, "Filter out declarations (unless inline).", },
     { RClient::KindFilter, "kind-filter", 0, required_argument, "Only return results matching this kind.", },
@@ -152,6 +156,8 @@ struct Option opts[] = {
     { RClient::UnescapeCompileCommands, "unescape-compile-commands", 0, no_argument, "Unescape \\'s and unquote arguments to -c." },
     { RClient::NoUnescapeCompileCommands, "no-unescape-compile-commands", 0, no_argument, "Escape \\'s and unquote arguments to -c." },
     { RClient::NoSortReferencesByInput, "no-sort-references-by-input", 0, no_argument, "Don't sort references by input position." },
+    { RClient::StreamReferences, "stream-references", 0, no_argument, "Write references as they're found, current file first, and stop at --max." },
+    { RClient::Binary, "binary", 0, no_argument, "Write locations and symbols as length prefixed binary records with a table of paths instead of lines of text." },
     { RClient::ProjectRoot, "project-root", 0, required_argument, "Override project root for compile commands." },
     { RClient::RTagsConfig, "rtags-config", 0, required_argument, "Print out .rtags-config for argument." },
     { RClient::WildcardSymbolNames, "wildcard-symbol-names", 'a', no_argument, "Expand * like wildcards in --list-symbols and --find-symbols." },
@@ -273,6 +279,7 @@ public:
         msg.setRangeFilter(rc->minOffset(), rc->maxOffset());
         msg.setTerminalWidth(rc->terminalWidth());
         msg.setCurrentFile(rc->currentFile());
+        msg.setClientTag(rc->clientTag());
         return connection->send(msg);
     }
 
@@ -773,6 +780,46 @@ RClient::ParseStatus RClient::parse(int &argc, char **argv)
             }
             mUnsavedFiles[path] = contents;
             break; }
+        case Batch: {
+            List<QueryMessage::SubQuery> subQueries;
+            char buf[4096];
+            while (fgets(buf, sizeof(buf), stdin)) {
+                const List<String> words = String(buf).trimmed().split(' ', String::SkipEmpty);
+                if (words.isEmpty())
+                    continue;
+                QueryMessage::SubQuery sub;
+                if (words.first() == "follow-location") {
+                    sub.type = QueryMessage::FollowLocation;
+                } else if (words.first() == "symbol-info") {
+                    sub.type = QueryMessage::SymbolInfo;
+                } else if (words.first() == "references") {
+                    sub.type = QueryMessage::ReferencesLocation;
+                } else if (words.first() == "class-hierarchy") {
+                    sub.type = QueryMessage::ClassHierarchy;
+                } else {
+                    fprintf(stderr, "Unknown batch query %s\n", words.first().constData());
+                    return Parse_Error;
+                }
+                if (words.size() > 1)
+                    sub.query = Location::encode(words.at(1));
+                if (sub.query.isEmpty()) {
+                    fprintf(stderr, "Can't resolve location in batch query %s\n", String(buf).trimmed().constData());
+                    return Parse_Error;
+                }
+                for (int i=2; i<words.size(); ++i) {
+                    const QueryMessage::Flag flag = QueryMessage::flagFromString(words.at(i));
+                    if (flag == QueryMessage::NoFlag) {
+                        fprintf(stderr, "Unknown flag %s in batch query\n", words.at(i).constData());
+                        return Parse_Error;
+                    }
+                    sub.flags |= flag;
+                }
+                subQueries.append(sub);
+            }
+            QueryMessage batch(QueryMessage::Batch);
+            batch.setSubQueries(subQueries);
+            addQuery(QueryMessage::Batch, batch.query());
+            break; }
         case FollowLocation:
         case SymbolInfo:
         case ClassHierarchy:
@@ -795,6 +842,9 @@ RClient::ParseStatus RClient::parse(int &argc, char **argv)
         case CurrentFile:
             mCurrentFile.append(Path::resolved(optarg));
             break;
+        case ClientTag:
+            mClientTag = optarg;
+            break;
         case ReloadFileManager:
             addQuery(QueryMessage::ReloadFileManager);
             break;
@@ -1052,8 +1102,33 @@ RClient::ParseStatus RClient::parse(int &argc, char **argv)
         case NoSortReferencesByInput:
             mQueryFlags |= QueryMessage::NoSortReferencesByInput;
             break;
+        case StreamReferences:
+            mQueryFlags |= QueryMessage::StreamReferences;
+            break;
+        case Binary:
+            mQueryFlags |= QueryMessage::Binary;
+            break;
+        case Export: {
+            const char *arg = 0;
+            if (optarg) {
+                arg = optarg;
+            } else if (optind < argc && argv[optind][0] != '-') {
+                arg = argv[optind++];
+            }
+            String cursor;
+            if (arg) {
+                bool ok;
+                cursor = String::number(String(arg).toULongLong(&ok));
+                if (!ok) {
+                    fprintf(stderr, "Invalid fileId %s\n", arg);
+                    return Parse_Error;
+                }
+            }
+            addQuery(QueryMessage::Export, cursor);
+            break; }
         case IsIndexed:
         case DumpFile:
+        case FileSymbols:
         case GenerateTest:
         case Diagnose:
         case FixIts: {
@@ -1080,6 +1155,7 @@ RClient::ParseStatus RClient::parse(int &argc, char **argv)
             case GenerateTest: type = QueryMessage::GenerateTest; break;
             case FixIts: type = QueryMessage::FixIts; break;
             case DumpFile: type = QueryMessage::DumpFile; break;
+            case FileSymbols: type = QueryMessage::FileSymbols; break;
             case Diagnose: type = QueryMessage::Diagnose; break;
             case IsIndexed: type = QueryMessage::IsIndexed; break;
             default: assert(0); break;
@@ -1188,9 +1264,12 @@ RClient::ParseStatus RClient::parse(int &argc, char **argv)
 void RClient::onNewMessage(const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &)
 {
     if (message->messageId() == ResponseMessage::MessageId) {
+        // rdm sends many lines per response, see QueryJob::flush()
         const String response = std::static_pointer_cast<ResponseMessage>(message)->data();
         if (!response.isEmpty() && mLogLevel >= LogLevel::Error) {
-            fprintf(stdout, "%s\n", response.constData());
+            fwrite(response.constData(), 1, response.size(), stdout);
+            if (!(mQueryFlags & QueryMessage::Binary))
+                fputc('\n', stdout);
             fflush(stdout);
         }
     } else {
@@ -34,10 +34,13 @@ public:
         AllReferences,
         AllDependencies,
         AllTargets,
+        Batch,
+        Binary,
         BuildIndex,
         CheckReindex,
         ClassHierarchy,
         Clear,
+        ClientTag,
         CodeCompleteAt,
         CompilationFlagsOnly,
         CompilationFlagsSplitLine,
@@ -60,6 +63,8 @@ public:
         DumpFileMaps,
         DumpIncludeHeaders,
         Elisp,
+        Export,
+        FileSymbols,
         FilterSystemHeaders,
         FindFile,
         FindFilePreferExact,
@@ -114,6 +119,7 @@ public:
         SocketFile,
         Sources,
         Status,
+        StreamReferences,
         StripParen,
         Suspend,
         SymbolInfo,
@@ -156,6 +162,7 @@ public:
 
     const List<String> &rdmArgs() const { return mRdmArgs; }
     const Path &currentFile() const { return mCurrentFile; }
+    const String &clientTag() const { return mClientTag; }
 
     String socketFile() const { return mSocketFile; }
     Path projectRoot() const { return mProjectRoot; }
@@ -191,6 +198,7 @@ private:
     List<String> mRdmArgs;
     String mSocketFile;
     Path mCurrentFile;
+    String mClientTag;
     EscapeMode mEscapeMode;
     bool mGuessFlags;
     Path mProjectRoot;
@@ -38,10 +38,13 @@ namespace RTags {
 enum {
     MajorVersion = 2,
     MinorVersion = 0,
-    DatabaseVersion = 78,
+    DatabaseVersion = 87,
     SourcesFileVersion = 3
 };
 
+// rp exits with this when an allocation fails
+enum { OutOfMemoryExitCode = 42 };
+
 inline String versionString()
 {
     return String::format<64>("%d.%d.%d", MajorVersion, MinorVersion, DatabaseVersion);
@@ -170,6 +173,32 @@ inline void decodePath(Path &path)
     }
 }
 
+// FNV-1a, used to tell whether a modified file actually changed
+inline uint64_t contentHash(const String &data)
+{
+    uint64_t hash = 14695981039346656037ull;
+    const char *ch = data.constData();
+    const char *end = ch + data.size();
+    while (ch != end) {
+        hash ^= static_cast<unsigned char>(*ch++);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// A file's contentHash() and the modification time it was taken at
+struct FileHash
+{
+    FileHash()
+        : hash(0), lastModified(0), recorded(0)
+    {}
+
+    uint64_t hash, lastModified;
+    // parse time of the job that visited the file, the hash is only known to
+    // match what sources parsed since then saw
+    uint64_t recorded;
+};
+
 inline int digits(int len)
 {
     int ret = 1;
@@ -312,4 +341,16 @@ static inline const String elispEscape(const String &data)
 }
 }
 
+template <> inline Serializer &operator<<(Serializer &s, const RTags::FileHash &hash)
+{
+    s << hash.hash << hash.lastModified << hash.recorded;
+    return s;
+}
+
+template <> inline Deserializer &operator>>(Deserializer &s, RTags::FileHash &hash)
+{
+    s >> hash.hash >> hash.lastModified >> hash.recorded;
+    return s;
+}
+
 #endif
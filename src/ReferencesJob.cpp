@@ -56,6 +56,11 @@ int ReferencesJob::execute()
     }
     const bool declarationOnly = queryFlags() & QueryMessage::DeclarationOnly;
     const bool definitionOnly = queryFlags() & QueryMessage::DefinitionOnly;
+    // streamed references are written as they're found, the search stops at --max
+    const bool stream = !rename && queryFlags() & QueryMessage::StreamReferences;
+    const int max = queryMessage()->max();
+    Set<Location> seen;
+    int written = 0;
     Location startLocation;
     bool first = true;
     for (auto it = locations.begin(); it != locations.end(); ++it) {
@@ -90,6 +95,38 @@ int ReferencesJob::execute()
             if (sym.isNull())
                 continue;
         }
+        if (stream) {
+            const bool allReferences = queryFlags() & QueryMessage::AllReferences;
+            uint32_t firstFile = Location::fileId(queryMessage()->currentFile());
+            if (!firstFile)
+                firstFile = pos.fileId();
+            Project::ReferenceStream referenceStream(firstFile, [&](const Symbol &symbol) {
+                    if (isAborted())
+                        return false;
+                    if (allReferences && sym.isClass() && symbol.isConstructorOrDestructor())
+                        return true;
+                    if (symbol.isDefinition() ? declarationOnly : definitionOnly)
+                        return true;
+                    // streamed references go out as they're found, the
+                    // rest of the scan can take a while
+                    if (seen.insert(symbol.location) && write(symbol.location, Flush))
+                        ++written;
+                    return max == -1 || written < max;
+                });
+            if (allReferences) {
+                proj->findAllReferences(sym, &referenceStream);
+            } else if (queryFlags() & QueryMessage::FindVirtuals) {
+                for (const auto &symbol : proj->findVirtuals(sym)) {
+                    if (!referenceStream(symbol))
+                        break;
+                }
+            } else {
+                proj->findCallers(sym, &referenceStream);
+            }
+            if (referenceStream.stopped)
+                break;
+            continue;
+        }
         if (queryFlags() & QueryMessage::AllReferences) {
             const Set<Symbol> all = proj->findAllReferences(sym);
             for (const auto &symbol : all) {
@@ -136,7 +173,9 @@ int ReferencesJob::execute()
             }
         }
     }
-    if (rename) {
+    if (stream) {
+        return written ? 0 : 1;
+    } else if (rename) {
         if (!references.isEmpty()) {
             if (queryFlags() & QueryMessage::ReverseSort) {
                 Map<Location, std::pair<bool, CXCursorKind> >::const_iterator it = references.end();
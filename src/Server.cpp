@@ -15,6 +15,7 @@
 
 #include "Server.h"
 
+#include "BatchJob.h"
 #include "CompletionThread.h"
 #include "IndexMessage.h"
 #include "LogOutputMessage.h"
@@ -22,6 +23,8 @@
 #include "DependenciesJob.h"
 #include "VisitFileResponseMessage.h"
 #include "Filter.h"
+#include "ExportJob.h"
+#include "FileSymbolsJob.h"
 #include "FindFileJob.h"
 #include "IncludeFileJob.h"
 #include "RClient.h"
@@ -48,6 +51,7 @@
 #include "StatusJob.h"
 #include <clang-c/Index.h>
 #include <rct/Connection.h>
+#include <rct/FinishMessage.h>
 #include <rct/DataFile.h>
 #include <rct/Value.h>
 #include <rct/EventLoop.h>
@@ -57,6 +61,7 @@
 #include <rct/Path.h>
 #include <rct/Process.h>
 #include <rct/Rct.h>
+#include <rct/ThreadPool.h>
 #include <stdio.h>
 #include <arpa/inet.h>
 #include <limits>
@@ -88,7 +93,7 @@ void saveFileIds()
 
 Server *Server::sInstance = 0;
 Server::Server()
-    : mSuspended(false), mPathEnvironment(Rct::pathEnvironment()), mExitCode(0), mLastFileId(0), mCompletionThread(0)
+    : mSuspended(false), mPathEnvironment(Rct::pathEnvironment()), mExitCode(0), mLastFileId(0), mCompletionThread(0), mQueryThreadPool(0), mFileScanThreadPool(0)
 {
     assert(!sInstance);
     sInstance = this;
@@ -103,9 +108,15 @@ Server::~Server()
         mCompletionThread = 0;
     }
 
+    delete mQueryThreadPool;
+    mQueryThreadPool = 0;
+    delete mFileScanThreadPool;
+    mFileScanThreadPool = 0;
+
     stopServers();
     mProjects.clear(); // need to be destroyed before sInstance is set to 0
     assert(sInstance == this);
+    Location::setFileInsertedCallback(0);
     sInstance = 0;
     Message::cleanup();
 }
@@ -115,6 +126,7 @@ bool Server::init(const Options &options)
     RTags::initMessages();
 
     mOptions = options;
+    Location::setFileInsertedCallback(::saveFileIds);
     mSuspended = (options.flag(StartSuspended));
     if (!(options.flag(NoUnlimitedErrors)))
         mOptions.defaultArguments << "-ferror-limit=0";
@@ -161,6 +173,10 @@ bool Server::init(const Options &options)
         return false;
     }
 
+    mQueryThreadPool = new ThreadPool(std::max(2, ThreadPool::idealThreadCount()), Thread::Normal, mOptions.threadStackSize);
+    // findReferences() splits its per-file scans across this one, see Project::scanFiles()
+    mFileScanThreadPool = new ThreadPool(ThreadPool::idealThreadCount(), Thread::Normal, mOptions.threadStackSize);
+
     {
         Log l(LogLevel::Error);
         l << "Running with" << mOptions.jobCount << "jobs, using args:"
@@ -582,6 +598,9 @@ void Server::handleQueryMessage(const std::shared_ptr<QueryMessage> &message, co
     case QueryMessage::Invalid:
         assert(0);
         break;
+    case QueryMessage::Batch:
+        batch(message, conn);
+        break;
     case QueryMessage::Sources:
         sources(message, conn);
         break;
@@ -628,6 +647,12 @@ void Server::handleQueryMessage(const std::shared_ptr<QueryMessage> &message, co
     case QueryMessage::DumpFileMaps:
         dumpFileMaps(message, conn);
         break;
+    case QueryMessage::FileSymbols:
+        fileSymbols(message, conn);
+        break;
+    case QueryMessage::Export:
+        exportSymbols(message, conn);
+        break;
     case QueryMessage::Diagnose:
         diagnose(message, conn);
         break;
@@ -689,11 +714,77 @@ void Server::handleQueryMessage(const std::shared_ptr<QueryMessage> &message, co
     }
 }
 
+void Server::batch(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
+{
+    // the jobs share one scope so they all have to be in the same project,
+    // sub queries without one are answered with "Not indexed"
+    List<std::shared_ptr<QueryMessage> > queries;
+    List<std::shared_ptr<Project> > projects;
+    std::shared_ptr<Project> project;
+    for (const QueryMessage::SubQuery &sub : query->subQueries()) {
+        queries.append(query->subQuery(sub));
+        projects.append(projectForQuery(queries.last()));
+        const std::shared_ptr<Project> &subProject = projects.last();
+        if (!subProject)
+            continue;
+        if (!project) {
+            project = subProject;
+        } else if (subProject != project) {
+            writeNotIndexed(query, conn, "Batch queries have to be in the same project");
+            conn->finish(1);
+            return;
+        }
+    }
+    if (!project) {
+        error("No project");
+        conn->finish(1);
+        return;
+    }
+
+    List<std::shared_ptr<QueryJob> > jobs;
+    for (int i=0; i<queries.size(); ++i) {
+        const std::shared_ptr<QueryMessage> &q = queries.at(i);
+        const Location loc = q->location();
+        std::shared_ptr<QueryJob> job;
+        if (!loc.isNull() && projects.at(i)) {
+            switch (q->type()) {
+            case QueryMessage::FollowLocation:
+                job = std::make_shared<FollowLocationJob>(loc, q, project);
+                break;
+            case QueryMessage::SymbolInfo:
+                job = std::make_shared<SymbolInfoJob>(loc, q, project);
+                break;
+            case QueryMessage::ReferencesLocation:
+                job = std::make_shared<ReferencesJob>(loc, q, project);
+                break;
+            case QueryMessage::ClassHierarchy:
+                job = std::make_shared<ClassHierarchyJob>(loc, q, project);
+                break;
+            default:
+                error("Unsupported query in batch: %d", q->type());
+                break;
+            }
+        }
+        jobs.append(job);
+    }
+    startQueryJob(std::make_shared<BatchJob>(query, project, jobs), conn);
+}
+
+void Server::writeNotIndexed(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn,
+                             const String &text)
+{
+    if (query->flags() & QueryMessage::Binary) {
+        conn->write(QueryJob::textRecord(text));
+    } else {
+        conn->write(text);
+    }
+}
+
 void Server::followLocation(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
 {
     const Location loc = query->location();
     if (loc.isNull()) {
-        conn->write("Not indexed");
+        writeNotIndexed(query, conn, "Not indexed");
         conn->finish(1);
         return;
     }
@@ -704,15 +795,8 @@ void Server::followLocation(const std::shared_ptr<QueryMessage> &query, const st
         return;
     }
 
-    int ret;
-    {
-        FollowLocationJob job(loc, query, project);
-        ret = job.run(conn);
-        if (!ret) {
-            conn->finish(ret);
-            return;
-        }
-    }
+    List<std::shared_ptr<QueryJob> > jobs;
+    jobs << std::make_shared<FollowLocationJob>(loc, query, project);
 
     /* We will try with another project under the following circumstances:
 
@@ -729,19 +813,13 @@ void Server::followLocation(const std::shared_ptr<QueryMessage> &query, const st
                 Path paths[] = { proj.first, proj.first };
                 paths[1].resolve();
                 for (const Path &projectPath : paths) {
-                    if (path.startsWith(projectPath)) {
-                        FollowLocationJob job(loc, query, proj.second);
-                        ret = job.run(conn);
-                        if (!ret) {
-                            conn->finish(ret);
-                            return;
-                        }
-                    }
+                    if (path.startsWith(projectPath))
+                        jobs << std::make_shared<FollowLocationJob>(loc, query, proj.second);
                 }
             }
         }
     }
-    conn->finish(ret);
+    startQueryJobs(jobs, conn);
 }
 
 void Server::isIndexing(const std::shared_ptr<QueryMessage> &, const std::shared_ptr<Connection> &conn)
@@ -799,14 +877,14 @@ void Server::dumpFile(const std::shared_ptr<QueryMessage> &query, const std::sha
 {
     const uint32_t fileId = Location::fileId(query->query());
     if (!fileId) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
 
     std::shared_ptr<Project> project = projectForQuery(query);
     if (!project) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
@@ -821,6 +899,34 @@ void Server::dumpFile(const std::shared_ptr<QueryMessage> &query, const std::sha
     }
 }
 
+void Server::fileSymbols(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
+{
+    const uint32_t fileId = Location::fileId(query->query());
+    std::shared_ptr<Project> project;
+    if (fileId)
+        project = projectForQuery(query);
+    if (!project) {
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
+        conn->finish(1);
+        return;
+    }
+
+    startQueryJob(std::make_shared<FileSymbolsJob>(fileId, query, project), conn);
+}
+
+void Server::exportSymbols(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
+{
+    std::shared_ptr<Project> project = currentProject();
+    if (!project) {
+        error("No project");
+        conn->finish(1);
+        return;
+    }
+
+    // ExportJob::drain() keeps the export from getting ahead of the client
+    startQueryJob(std::make_shared<ExportJob>(query->query().toULongLong(), query, project), conn);
+}
+
 void Server::dumpFileMaps(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
 {
     Path path;
@@ -828,7 +934,7 @@ void Server::dumpFileMaps(const std::shared_ptr<QueryMessage> &query, const std:
     deserializer >> path;
     const uint32_t fileId = Location::fileId(path);
     if (!fileId) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
@@ -845,7 +951,7 @@ void Server::dumpFileMaps(const std::shared_ptr<QueryMessage> &query, const std:
         }
     }
     if (!project) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
@@ -858,14 +964,14 @@ void Server::diagnose(const std::shared_ptr<QueryMessage> &query, const std::sha
 {
     const uint32_t fileId = Location::fileId(query->query());
     if (!fileId) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
 
     std::shared_ptr<Project> project = projectForQuery(query);
     if (!project) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
@@ -878,14 +984,14 @@ void Server::generateTest(const std::shared_ptr<QueryMessage> &query, const std:
 {
     const uint32_t fileId = Location::fileId(query->query());
     if (!fileId) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
 
     std::shared_ptr<Project> project = projectForQuery(query);
     if (!project) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
@@ -955,9 +1061,7 @@ void Server::cursorInfo(const std::shared_ptr<QueryMessage> &query, const std::s
     if (!project) {
         conn->finish();
     } else {
-        SymbolInfoJob job(loc, query, project);
-        const int ret = job.run(conn);
-        conn->finish(ret);
+        startQueryJob(std::make_shared<SymbolInfoJob>(loc, query, project), conn);
     }
 }
 
@@ -968,7 +1072,7 @@ void Server::dependencies(const std::shared_ptr<QueryMessage> &query, const std:
     deserializer >> path;
     const uint32_t fileId = Location::fileId(path);
     if (!fileId && !path.isEmpty()) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
@@ -989,7 +1093,7 @@ void Server::dependencies(const std::shared_ptr<QueryMessage> &query, const std:
         project = currentProject();
     }
     if (!project) {
-        conn->write<256>("%s is not indexed", query->query().constData());
+        writeNotIndexed(query, conn, query->query() + " is not indexed");
         conn->finish();
         return;
     }
@@ -1014,7 +1118,7 @@ void Server::referencesForLocation(const std::shared_ptr<QueryMessage> &query, c
 {
     const Location loc = query->location();
     if (loc.isNull()) {
-        conn->write("Not indexed");
+        writeNotIndexed(query, conn, "Not indexed");
         conn->finish();
         return;
     }
@@ -1026,9 +1130,7 @@ void Server::referencesForLocation(const std::shared_ptr<QueryMessage> &query, c
         return;
     }
 
-    ReferencesJob job(loc, query, project);
-    const int ret = job.run(conn);
-    conn->finish(ret);
+    startQueryJob(std::make_shared<ReferencesJob>(loc, query, project), conn);
 }
 
 void Server::referencesForName(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1043,9 +1145,7 @@ void Server::referencesForName(const std::shared_ptr<QueryMessage> &query, const
         return;
     }
 
-    ReferencesJob job(name, query, project);
-    const int ret = job.run(conn);
-    conn->finish(ret);
+    startQueryJob(std::make_shared<ReferencesJob>(name, query, project), conn);
 }
 
 void Server::findSymbols(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1054,15 +1154,12 @@ void Server::findSymbols(const std::shared_ptr<QueryMessage> &query, const std::
 
     std::shared_ptr<Project> project = currentProject();
 
-    int ret = 0;
     if (!project) {
-        ret = 1;
         error("No project");
+        conn->finish(1);
     } else {
-        FindSymbolsJob job(query, project);
-        ret = job.run(conn);
+        startQueryJob(std::make_shared<FindSymbolsJob>(query, project), conn);
     }
-    conn->finish(ret);
 }
 
 void Server::listSymbols(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1076,9 +1173,7 @@ void Server::listSymbols(const std::shared_ptr<QueryMessage> &query, const std::
         return;
     }
 
-    ListSymbolsJob job(query, project);
-    const int ret = job.run(conn);
-    conn->finish(ret);
+    startQueryJob(std::make_shared<ListSymbolsJob>(query, project), conn);
 }
 
 void Server::status(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1389,8 +1484,10 @@ void Server::jobCount(const std::shared_ptr<QueryMessage> &query, const std::sha
         if (!ok || jobCount < 0 || jobCount > 100) {
             conn->write<128>("Invalid job count %s (%d)", query->query().constData(), jobCount);
         } else {
+            const bool fixed = mOptions.minJobCount >= mOptions.jobCount;
             jobs = jobCount;
             mOptions.headerErrorJobCount = std::min(mOptions.headerErrorJobCount, mOptions.jobCount);
+            mOptions.minJobCount = fixed ? mOptions.jobCount : std::min(mOptions.minJobCount, mOptions.jobCount);
             conn->write<128>("Changed jobs to %d/%d", mOptions.jobCount, mOptions.headerErrorJobCount);
         }
     }
@@ -1546,7 +1643,7 @@ void Server::suspend(const std::shared_ptr<QueryMessage> &query, const std::shar
                 conn->write<512>("%s is no%s suspended", p.constData(),
                                  project->toggleSuspendFile(fileId) ? "w" : " longer");
             } else {
-                conn->write<512>("%s is not indexed", p.constData());
+                writeNotIndexed(query, conn, p + " is not indexed");
             }
         }
         break;
@@ -1578,7 +1675,7 @@ void Server::classHierarchy(const std::shared_ptr<QueryMessage> &query, const st
 {
     const Location loc = query->location();
     if (loc.isNull()) {
-        conn->write("Not indexed");
+        writeNotIndexed(query, conn, "Not indexed");
         conn->finish(1);
         return;
     }
@@ -1589,8 +1686,135 @@ void Server::classHierarchy(const std::shared_ptr<QueryMessage> &query, const st
         return;
     }
 
-    ClassHierarchyJob job(loc, query, project);
-    conn->finish(job.run(conn));
+    startQueryJob(std::make_shared<ClassHierarchyJob>(loc, query, project), conn);
+}
+
+class QueryThreadPoolJob : public ThreadPool::Job
+{
+public:
+    QueryThreadPoolJob(const List<std::shared_ptr<QueryJob> > &jobs,
+                       const std::shared_ptr<Connection> &conn,
+                       const std::function<void(int)> &finished)
+        : mJobs(jobs), mConnection(conn), mFinished(finished)
+    {}
+protected:
+    virtual void run() override
+    {
+        int ret = 1;
+        for (const auto &job : mJobs) {
+            if (job->isAborted())
+                break;
+            ret = job->run(mConnection);
+            if (!ret)
+                break;
+        }
+        // The jobs, their projects and the connection are handed over to
+        // the main thread so that's where they're released, after mFinished.
+        // Nothing on this thread may hold a reference once it's queued.
+        Finished *done = new Finished;
+        std::swap(done->jobs, mJobs);
+        std::swap(done->connection, mConnection);
+        done->ret = ret;
+        const std::function<void(int)> finished = mFinished;
+        EventLoop::mainEventLoop()->callLater([finished, done]() {
+                finished(done->ret);
+                delete done;
+            });
+    }
+private:
+    struct Finished {
+        List<std::shared_ptr<QueryJob> > jobs;
+        std::shared_ptr<Connection> connection;
+        int ret;
+    };
+    List<std::shared_ptr<QueryJob> > mJobs;
+    std::shared_ptr<Connection> mConnection;
+    const std::function<void(int)> mFinished;
+};
+
+void Server::startQueryJobs(const List<std::shared_ptr<QueryJob> > &jobs, const std::shared_ptr<Connection> &conn)
+{
+    // a new query from the same client makes the one it's still waiting for moot
+    const std::shared_ptr<QueryMessage> message = jobs.isEmpty() ? std::shared_ptr<QueryMessage>() : jobs.first()->queryMessage();
+    const String tag = message ? message->clientTag() : String();
+    if (!tag.isEmpty()) {
+        auto it = mTaggedQueries.find(tag);
+        if (it != mTaggedQueries.end()) {
+            for (const auto &old : it->second) {
+                if (std::shared_ptr<QueryJob> job = old.lock())
+                    job->abort();
+            }
+            mTaggedQueries.erase(it);
+        }
+    }
+
+    // queries against one project can be answered from its query cache
+    String cacheKey;
+    uint64_t generation = 0;
+    std::weak_ptr<QueryJob> cachedJob;
+    std::weak_ptr<Project> cachedProject;
+    if (jobs.size() == 1 && jobs.first()->project()) {
+        const std::shared_ptr<QueryJob> &job = jobs.first();
+        cacheKey = QueryCache::key(*job->queryMessage());
+        if (!cacheKey.isEmpty()) {
+            QueryCache &cache = job->project()->queryCache();
+            List<String> output;
+            int ret;
+            if (cache.lookup(cacheKey, output, ret)) {
+                if (!output.isEmpty()) {
+                    const bool binary = job->queryFlags() & QueryMessage::Binary;
+                    conn->write(String::join(output, binary ? "" : "\n"));
+                }
+                conn->finish(ret);
+                return;
+            }
+            generation = cache.generation();
+            job->setRecordOutput(true);
+            cachedJob = job;
+            cachedProject = job->project();
+        }
+    }
+
+    // The snapshot is taken now so the event loop can keep applying
+    // IndexDataMessages while the jobs run.
+    for (const auto &job : jobs) {
+        if (std::shared_ptr<Project> project = job->project())
+            job->setSnapshot(project->snapshot());
+    }
+    const auto key = conn->disconnected().connect([jobs](const std::shared_ptr<Connection> &) {
+            for (const auto &job : jobs)
+                job->abort();
+        });
+
+    std::weak_ptr<QueryJob> taggedJob;
+    if (!tag.isEmpty()) {
+        List<std::weak_ptr<QueryJob> > &tagged = mTaggedQueries[tag];
+        for (const auto &job : jobs)
+            tagged.append(job);
+        taggedJob = jobs.first();
+    }
+
+    std::weak_ptr<Connection> weak = conn;
+    mQueryThreadPool->start(std::make_shared<QueryThreadPoolJob>(jobs, conn, [this, weak, key, cacheKey, generation,
+                                                                              cachedJob, cachedProject,
+                                                                              tag, taggedJob](int ret) {
+                if (!tag.isEmpty()) {
+                    auto it = mTaggedQueries.find(tag);
+                    if (it != mTaggedQueries.end() && it->second.first().lock() == taggedJob.lock())
+                        mTaggedQueries.erase(it);
+                }
+                const std::shared_ptr<QueryJob> job = cachedJob.lock();
+                const std::shared_ptr<Project> project = cachedProject.lock();
+                if (job && project && !job->isAborted()) {
+                    bool allFiles;
+                    const Set<uint32_t> &files = job->recordedFiles(&allFiles);
+                    project->queryCache().insert(cacheKey, generation, files, allFiles, job->recordedOutput(), ret);
+                }
+                if (std::shared_ptr<Connection> c = weak.lock()) {
+                    c->disconnected().disconnect(key);
+                    c->finish(ret);
+                }
+            }), QueryJob::Priority);
 }
 
 void Server::handleVisitFileMessage(const std::shared_ptr<VisitFileMessage> &message, const std::shared_ptr<Connection> &conn)
@@ -1603,7 +1827,7 @@ void Server::handleVisitFileMessage(const std::shared_ptr<VisitFileMessage> &mes
     if (project && project->isActiveJob(key)) {
         assert(message->file() == message->file().resolved());
         fileId = Location::insertFile(message->file());
-        visit = project->visitFile(fileId, message->file(), key);
+        visit = project->visitFile(fileId, key);
     }
     VisitFileResponseMessage msg(fileId, visit);
     conn->send(msg);
@@ -1614,9 +1838,7 @@ void Server::load()
     const Path p = mOptions.dataDir + "fileids";
     DataFile fileIdsFile(mOptions.dataDir + "fileids", RTags::DatabaseVersion);
     if (fileIdsFile.open(DataFile::Read)) {
-        Hash<Path, uint32_t> pathsToIds;
-        fileIdsFile >> pathsToIds;
-        Location::init(pathsToIds);
+        Location::decodeFileIds(fileIdsFile.deserializer());
         List<Path> projects = mOptions.dataDir.files(Path::Directory);
         for (int i=0; i<projects.size(); ++i) {
             const Path &file = projects.at(i);
@@ -1702,8 +1924,7 @@ bool Server::saveFileIds()
         error("Can't save file ids: %s", fileIdsFile.error().constData());
         return false;
     }
-    const Hash<Path, uint32_t> pathsToIds = Location::pathsToIds();
-    fileIdsFile << pathsToIds;
+    Location::encodeFileIds(fileIdsFile.serializer());
     if (!fileIdsFile.flush()) {
         error("Can't save file ids: %s", fileIdsFile.error().constData());
         return false;
@@ -1788,30 +2009,177 @@ class TestConnection
 public:
     TestConnection(const Path &workingDirectory)
         : mConnection(Connection::create(RClient::NumOptions)),
-          mIsFinished(false), mWorkingDirectory(workingDirectory)
+          mIsFinished(false), mWaiting(false), mStatus(-1), mWorkingDirectory(workingDirectory)
     {
         mConnection->aboutToSend().connect([this](const std::shared_ptr<Connection> &, const Message *message) {
                 if (message->messageId() == Message::FinishMessageId) {
                     mIsFinished = true;
+                    mStatus = reinterpret_cast<const FinishMessage *>(message)->status();
+                    if (mWaiting)
+                        EventLoop::eventLoop()->quit();
                 } else if (message->messageId() == Message::ResponseId) {
-                    String response = reinterpret_cast<const ResponseMessage *>(message)->data();
-                    if (response.startsWith(mWorkingDirectory)) {
-                        response.remove(0, mWorkingDirectory.size());
+                    // query jobs send many lines per response
+                    const String response = reinterpret_cast<const ResponseMessage *>(message)->data();
+                    mData.append(response);
+                    for (String line : response.split('\n')) {
+                        if (line.startsWith(mWorkingDirectory)) {
+                            line.remove(0, mWorkingDirectory.size());
+                        }
+                        mOutput.append(line);
                     }
-                    mOutput.append(response);
                 }
             });
     }
     List<String> output() const { return mOutput; }
+    // QueryMessage::Binary output decoded to one line per record
+    List<String> decodedOutput() const;
+    int status() const { return mStatus; }
     bool isFinished() const { return mIsFinished; }
+    // queries on the query thread pool finish from the event loop
+    bool waitForFinished(int timeout)
+    {
+        if (!mIsFinished) {
+            mWaiting = true;
+            EventLoop::eventLoop()->exec(timeout);
+            mWaiting = false;
+        }
+        return mIsFinished;
+    }
     std::shared_ptr<Connection> connection() const { return mConnection; }
 private:
     std::shared_ptr<Connection> mConnection;
-    bool mIsFinished;
+    bool mIsFinished, mWaiting;
+    int mStatus;
     List<String> mOutput;
+    String mData;
     const Path mWorkingDirectory;
 };
 
+List<String> TestConnection::decodedOutput() const
+{
+    List<String> ret;
+    Hash<uint32_t, Path> paths;
+    const char *data = mData.constData();
+    const char *end = data + mData.size();
+    auto varint = [&data, end]() {
+        uint64_t value = 0;
+        for (int shift = 0; data < end; shift += 7) {
+            const unsigned char ch = *data++;
+            value |= static_cast<uint64_t>(ch & 0x7f) << shift;
+            if (!(ch & 0x80))
+                break;
+        }
+        return value;
+    };
+    auto string = [&data, end, &varint]() {
+        const uint64_t size = std::min<uint64_t>(varint(), end - data);
+        const String value(data, size);
+        data += size;
+        return value;
+    };
+    auto location = [&paths, &varint]() {
+        const Path path = paths.value(varint());
+        const unsigned int line = varint();
+        const unsigned int column = varint();
+        return String::format<256>("%s:%d:%d:", path.constData(), line, column);
+    };
+    while (data < end) {
+        const uint64_t size = varint();
+        const char *next = data + size;
+        if (!size || next > end) {
+            ret.append("Invalid record");
+            break;
+        }
+        switch (*data++) {
+        case QueryJob::PathRecord: {
+            const uint32_t fileId = varint();
+            Path path(data, next - data);
+            if (path.startsWith(mWorkingDirectory))
+                path.remove(0, mWorkingDirectory.size());
+            paths[fileId] = path;
+            break; }
+        case QueryJob::LocationRecord: {
+            String out = location();
+            const CXCursorKind kind = static_cast<CXCursorKind>(varint());
+            if (kind != CXCursor_FirstInvalid)
+                out += '\t' + Symbol::kindSpelling(kind);
+            ret.append(out);
+            break; }
+        case QueryJob::SymbolRecord: {
+            String out = location();
+            const CXCursorKind kind = static_cast<CXCursorKind>(varint());
+            const int length = varint();
+            const int definition = varint();
+            const String name = string();
+            out += String::format<256>("\t%s\t%d\t%d\t%s\t%s", Symbol::kindSpelling(kind).constData(),
+                                       length, definition, name.constData(), string().constData());
+            ret.append(out);
+            break; }
+        case QueryJob::TextRecord: {
+            String text(data, next - data);
+            if (text.startsWith(mWorkingDirectory))
+                text.remove(0, mWorkingDirectory.size());
+            ret.append(text);
+            break; }
+        default:
+            ret.append("Invalid record");
+            break;
+        }
+        data = next;
+    }
+    return ret;
+}
+
+static bool testFlags(const Value &test, Flags<QueryMessage::Flag> &flags)
+{
+    for (const auto &flag : test.operator[]<List<Value> >("flags")) {
+        const QueryMessage::Flag f = flag.isString() ? QueryMessage::flagFromString(flag.convert<String>()) : QueryMessage::NoFlag;
+        if (f == QueryMessage::NoFlag) {
+            error() << "Invalid flag";
+            return false;
+        }
+        flags |= f;
+    }
+    return true;
+}
+
+// What a test, or one of a batch test's queries, asks for
+static bool testQuery(const Value &test, const Path &workingDirectory, QueryMessage::SubQuery &query)
+{
+    const String type = test.operator[]<String>("type");
+    if (type.isEmpty()) {
+        error() << "Invalid test. No type";
+        return false;
+    }
+    if (type == "follow-location" || type == "references") {
+        query.query = Location::encode(test.operator[]<String>("location"), workingDirectory);
+        if (query.query.isEmpty()) {
+            error() << "Invalid test. Invalid location";
+            return false;
+        }
+        query.type = type == "references" ? QueryMessage::ReferencesLocation : QueryMessage::FollowLocation;
+    } else if (type == "references-name") {
+        query.query = test.operator[]<String>("name");
+        if (query.query.isEmpty()) {
+            error() << "Invalid test. Invalid name";
+            return false;
+        }
+        query.type = QueryMessage::ReferencesLocation;
+    } else if (type == "file-symbols") {
+        const String file = test.operator[]<String>("file");
+        if (file.isEmpty()) {
+            error() << "Invalid test. Invalid file";
+            return false;
+        }
+        query.query = workingDirectory + file;
+        query.type = QueryMessage::FileSymbols;
+    } else {
+        error() << "Unknown test" << type;
+        return false;
+    }
+    return testFlags(test, query.flags);
+}
+
 bool Server::runTests()
 {
     assert(!mOptions.tests.isEmpty());
@@ -1890,65 +2258,50 @@ bool Server::runTests()
                 ret = false;
                 continue;
             }
-            const String type = test.operator[]<String>("type");
-            if (type.isEmpty()) {
-                error() << "Invalid test. No type";
-                ret = false;
-                continue;
-            }
             std::shared_ptr<QueryMessage> query;
-            if (type == "follow-location") {
-                const String location = Location::encode(test.operator[]<String>("location"), workingDirectory);
-                if (location.isEmpty()) {
-                    error() << "Invalid test. Invalid location";
+            if (test.operator[]<String>("type") == "batch") {
+                // "queries" run as one batch, each with its own type and flags
+                List<QueryMessage::SubQuery> subQueries;
+                Flags<QueryMessage::Flag> flags;
+                if (!testFlags(test, flags)) {
                     ret = false;
                     continue;
                 }
-                query.reset(new QueryMessage(QueryMessage::FollowLocation));
-                query->setQuery(location);
-            } else if (type == "references") {
-                const String location = Location::encode(test.operator[]<String>("location"), workingDirectory);
-                if (location.isEmpty()) {
-                    error() << "Invalid test. Invalid location";
-                    ret = false;
-                    continue;
+                for (const auto &sub : test.operator[]<List<Value> >("queries")) {
+                    QueryMessage::SubQuery subQuery;
+                    if (!sub.isMap() || !testQuery(sub, workingDirectory, subQuery)) {
+                        subQueries.clear();
+                        break;
+                    }
+                    subQueries.append(subQuery);
                 }
-                query.reset(new QueryMessage(QueryMessage::ReferencesLocation));
-                query->setQuery(location);
-            } else if (type == "references-name") {
-                const String name = test.operator[]<String>("name");
-                if (name.isEmpty()) {
-                    error() << "Invalid test. Invalid name";
+                if (subQueries.isEmpty()) {
+                    error() << "Invalid test. Invalid queries";
                     ret = false;
                     continue;
                 }
-                query.reset(new QueryMessage(QueryMessage::ReferencesLocation));
-                query->setQuery(name);
+                query.reset(new QueryMessage(QueryMessage::Batch));
+                query->setSubQueries(subQueries);
+                query->setFlags(flags);
             } else {
-                error() << "Unknown test" << type;
-                ret = false;
-                continue;
-            }
-            const List<Value> flags = test.operator[]<List<Value> >("flags");
-            for (const auto &flag : flags) {
-                if (!flag.isString()) {
-                    error() << "Invalid flag";
+                QueryMessage::SubQuery subQuery;
+                if (!testQuery(test, workingDirectory, subQuery)) {
                     ret = false;
-                } else {
-                    const QueryMessage::Flag f = QueryMessage::flagFromString(flag.convert<String>());
-                    if (f == QueryMessage::NoFlag) {
-                        error() << "Invalid flag";
-                        ret = false;
-                        continue;
-                    }
-                    query->setFlag(f);
+                    continue;
                 }
+                query.reset(new QueryMessage(subQuery.type));
+                query->setQuery(subQuery.query);
+                query->setFlags(subQuery.flags);
+                // "max" is optional, like --max
+                const Value max = test["max"];
+                if (max.isInteger())
+                    query->setMax(max.convert<int>());
             }
 
             TestConnection conn(workingDirectory);
             query->setFlag(QueryMessage::SilentQuery);
             handleQueryMessage(query, conn.connection());
-            if (!conn.isFinished()) {
+            if (!conn.waitForFinished(mOptions.testTimeout)) {
                 error() << "Query failed";
                 ret = false;
                 continue;
@@ -1969,11 +2322,19 @@ bool Server::runTests()
                 }
                 output.append(it->convert<String>());
             }
-            if (output != conn.output()) {
+            const List<String> got = query->flags() & QueryMessage::Binary ? conn.decodedOutput() : conn.output();
+            // "returnCode" is optional, the query's exit status
+            const Value returnCode = test["returnCode"];
+            if (output != got) {
                 error() << "Test" << idx << "failed. Expected:";
                 error() << output;
                 error() << "Got:";
-                error() << conn.output();
+                error() << got;
+                ret = false;
+                ++failures;
+            } else if (returnCode.isInteger() && returnCode.convert<int>() != conn.status()) {
+                error() << "Test" << idx << "failed. Expected return code" << returnCode.convert<int>()
+                        << "got" << conn.status();
                 ret = false;
                 ++failures;
             } else {
@@ -44,6 +44,7 @@ class Project;
 class QueryMessage;
 class VisitFileMessage;
 class JobScheduler;
+class ThreadPool;
 class Server
 {
 public:
@@ -73,11 +74,13 @@ public:
         Weverything = 0x40000,
         NoComments = 0x80000,
         Launchd = 0x100000,     /* Only valid for Darwin... but you're not out of bits yet. */
-        RPLogToSyslog = 0x200000
+        RPLogToSyslog = 0x200000,
+        IndexerCallbacks = 0x400000
     };
     struct Options {
         Options()
-            : jobCount(0), headerErrorJobCount(0),
+            : jobCount(0), headerErrorJobCount(0), reservedJobCount(0), minJobCount(0),
+              rpMemoryLimit(0), indexCacheSize(0), rpBatchSize(0),
               rpVisitFileTimeout(0), rpIndexDataMessageTimeout(0), rpConnectTimeout(0),
               rpConnectAttempts(0), rpNiceValue(0), threadStackSize(0), maxCrashCount(0),
               completionCacheSize(0), testTimeout(60 * 1000 * 5),
@@ -85,9 +88,9 @@ public:
         {
         }
 
-        Path socketFile, dataDir, argTransform;
+        Path socketFile, dataDir, argTransform, indexCacheDir;
         Flags<Option> options;
-        int jobCount, headerErrorJobCount, rpVisitFileTimeout, rpIndexDataMessageTimeout,
+        int jobCount, headerErrorJobCount, reservedJobCount, minJobCount, rpMemoryLimit, indexCacheSize, rpBatchSize, rpVisitFileTimeout, rpIndexDataMessageTimeout,
             rpConnectTimeout, rpConnectAttempts, rpNiceValue, threadStackSize, maxCrashCount,
             completionCacheSize, testTimeout, maxFileMapScopeCacheSize;
         List<String> defaultArguments, excludeFilters;
@@ -110,6 +113,7 @@ public:
     int mongooseStatistics(struct mg_connection *conn);
     void dumpJobs(const std::shared_ptr<Connection> &conn);
     std::shared_ptr<JobScheduler> jobScheduler() const { return mJobScheduler; }
+    ThreadPool *fileScanThreadPool() const { return mFileScanThreadPool; }
     const Set<uint32_t> &activeBuffers() const { return mActiveBuffers; }
     bool isActiveBuffer(uint32_t fileId) const { return mActiveBuffers.contains(fileId); }
     int exitCode() const { return mExitCode; }
@@ -134,6 +138,7 @@ private:
     void handleVisitFileMessage(const std::shared_ptr<VisitFileMessage> &message, const std::shared_ptr<Connection> &conn);
 
     // Queries
+    void batch(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void sendDiagnostics(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void clearProjects(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void codeCompleteAt(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
@@ -141,11 +146,16 @@ private:
     void dependencies(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void dumpFile(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void dumpFileMaps(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
+    void exportSymbols(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void diagnose(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void generateTest(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
+    void fileSymbols(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void findFile(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void findSymbols(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void fixIts(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
+    // a TextRecord with QueryMessage::Binary so it doesn't break the record stream
+    void writeNotIndexed(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn,
+                         const String &text);
     void followLocation(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void hasFileManager(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void includeFile(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
@@ -179,6 +189,14 @@ private:
     void startJobs();
     bool initUnixServer();
     void removeSocketFile();
+    // Runs read-only queries on the query thread pool. The jobs run one
+    // after the other until one succeeds and the connection is finished with
+    // the last one's return value.
+    void startQueryJobs(const List<std::shared_ptr<QueryJob> > &jobs, const std::shared_ptr<Connection> &conn);
+    void startQueryJob(const std::shared_ptr<QueryJob> &job, const std::shared_ptr<Connection> &conn)
+    {
+        startQueryJobs(List<std::shared_ptr<QueryJob> >() << job, conn);
+    }
 
     typedef Hash<Path, std::shared_ptr<Project> > ProjectsMap;
     ProjectsMap mProjects;
@@ -194,8 +212,11 @@ private:
     uint32_t mLastFileId;
     std::shared_ptr<JobScheduler> mJobScheduler;
     CompletionThread *mCompletionThread;
+    ThreadPool *mQueryThreadPool, *mFileScanThreadPool;
     Set<uint32_t> mActiveBuffers;
     Set<std::shared_ptr<Connection> > mConnections;
+    // the running query of each QueryMessage::clientTag()
+    Hash<String, List<std::weak_ptr<QueryJob> > > mTaggedQueries;
 
     Signal<std::function<void()> > mIndexDataMessageReceived;
     friend void saveFileIds();
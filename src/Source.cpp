@@ -690,6 +690,116 @@ List<Source> Source::parse(const String &cmdLine,
         warning() << "Parsed Source(s) successfully:" << ret;
     return ret;
 }
+// -g, -g0 through -g3 and the -g options that pick the debug info format
+static inline bool isDebugFlag(const String &arg)
+{
+    if (!arg.startsWith("-g"))
+        return false;
+    if (arg.size() == 2 || (arg.size() == 3 && isdigit(static_cast<unsigned char>(arg.at(2)))))
+        return true;
+    static const char *prefixes[] = {
+        "-ggdb", "-gdwarf", "-gstabs", "-gcoff", "-gxcoff", "-gvms", "-gcodeview",
+        "-gline-", "-gsplit-dwarf", "-gcolumn-info", "-gno-", "-gz", "-gfull", "-gused",
+        "-gmodules", "-gembed-source", "-grecord-", "-gstrict-dwarf", "-gpubnames", "-ggnu-pubnames",
+        0
+    };
+    for (int i = 0; prefixes[i]; ++i) {
+        if (arg.startsWith(prefixes[i]))
+            return true;
+    }
+    return false;
+}
+
+// -O, -O0 through -O3, -Os, -Oz, -Ofast and -Og
+static inline bool isOptimizationFlag(const String &arg)
+{
+    if (!arg.startsWith("-O"))
+        return false;
+    const String level = arg.mid(2);
+    return (level.isEmpty() || level == "s" || level == "z" || level == "g" || level == "fast"
+            || (level.size() == 1 && isdigit(static_cast<unsigned char>(level.at(0)))));
+}
+
+// Flags that only affect code generation or how diagnostics are printed.
+// -O does define __OPTIMIZE__ but we don't consider that worth indexing twice
+// for unless debug and release builds are to be kept apart. Warning flags
+// change the diagnostics we report so they're not in here.
+static inline bool isSemanticallyIrrelevant(const String &arg, bool separateDebugAndRelease)
+{
+    if (isDebugFlag(arg) || isOptimizationFlag(arg))
+        return !separateDebugAndRelease;
+    static const char *args[] = {
+        "-pipe",
+        "-fcolor-diagnostics",
+        "-fno-color-diagnostics",
+        "-ffunction-sections",
+        "-fdata-sections",
+        "-fomit-frame-pointer",
+        "-fno-omit-frame-pointer",
+        0
+    };
+    if (arg.startsWith("-fdebug-") || arg.startsWith("-fmessage-length"))
+        return true;
+    for (int i = 0; args[i]; ++i) {
+        if (arg == args[i])
+            return true;
+    }
+    return false;
+}
+
+uint64_t Source::fingerprint(const Path &root) const
+{
+    const Server::Options *opts = serverOptions();
+    const bool separateDebugAndRelease = opts && opts->options & Server::SeparateDebugAndRelease;
+
+    auto relative = [&root](const String &str) -> String {
+        if (root.isEmpty() || !str.contains(root))
+            return str;
+        String ret = str;
+        ret.replace(root, String());
+        return ret;
+    };
+
+    String data;
+    data.reserve(1024);
+    const int lang = language;
+    data.append(reinterpret_cast<const char *>(&compilerId), sizeof(compilerId));
+    data.append(reinterpret_cast<const char *>(&lang), sizeof(lang));
+    if (root.isEmpty()) {
+        data.append(reinterpret_cast<const char *>(&includePathHash), sizeof(includePathHash));
+    } else {
+        for (const auto &include : includePaths) {
+            data += static_cast<char>(include.type);
+            data += relative(include.path);
+            data += '\0';
+        }
+    }
+    for (const auto &define : defines) {
+        if (!separateDebugAndRelease && define.define == "NDEBUG")
+            continue;
+        data += define.define;
+        data += '=';
+        data += relative(define.value);
+        data += '\0';
+    }
+    data += '\0';
+
+    const int count = arguments.size();
+    for (int i=0; i<count; ++i) {
+        const String &arg = arguments.at(i);
+        if (isBlacklisted(arg)) {
+            if (hasValue(arg))
+                ++i;
+        } else if (arg == "-Xassembler" || arg == "-Xlinker") {
+            ++i;
+        } else if (!isSemanticallyIrrelevant(arg, separateDebugAndRelease)) {
+            data += relative(arg);
+            data += '\0';
+        }
+    }
+    return RTags::contentHash(data);
+}
+
 // returns false if at end
 static inline bool advance(Set<Source::Define>::const_iterator &it, const Set<Source::Define>::const_iterator end)
 {
@@ -733,7 +843,7 @@ static bool nextArg(List<String>::const_iterator &it,
             ++it;
             if (val && it != end)
                 ++it;
-        } else if (!separateDebugAndRelease && (*it == "-g" || it->startsWith("-O"))) {
+        } else if (!separateDebugAndRelease && (isDebugFlag(*it) || isOptimizationFlag(*it))) {
             ++it;
         } else {
             break;
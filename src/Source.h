@@ -157,6 +157,11 @@ struct Source
     }
 
     int compare(const Source &other) const;
+    // Hash of everything that affects what the indexer produces, the index
+    // cache key. Unlike compareArguments() it also ignores flags that only
+    // affect code generation, like -pipe or -ffunction-sections. Paths below
+    // root are hashed relative to it.
+    uint64_t fingerprint(const Path &root = Path()) const;
     bool compareArguments(const Source &other) const;
     bool operator==(const Source &other) const;
     bool operator!=(const Source &other) const;
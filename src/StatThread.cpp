@@ -13,23 +13,17 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 
-#ifndef JSONJob_h
-#define JSONJob_h
+#include "StatThread.h"
 
-#include <rct/String.h>
-#include "QueryJob.h"
-#include "RTags.h"
-#include "Match.h"
-
-class QueryMessage;
-class JSONJob : public QueryJob
+StatThread::StatThread(const Hash<uint32_t, Path> &files)
+    : Thread(), mFiles(files)
 {
-public:
-    JSONJob(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Project> &project);
-protected:
-    virtual void execute() override;
-private:
-    const Match match;
-};
+}
 
-#endif
+void StatThread::run()
+{
+    Hash<uint32_t, uint64_t> lastModified;
+    for (const auto &it : mFiles)
+        lastModified[it.first] = it.second.lastModifiedMs();
+    mFinished(lastModified);
+}
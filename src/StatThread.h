@@ -0,0 +1,35 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef StatThread_h
+#define StatThread_h
+
+#include <rct/Thread.h>
+#include <rct/Path.h>
+#include <rct/SignalSlot.h>
+
+class StatThread : public Thread
+{
+public:
+    StatThread(const Hash<uint32_t, Path> &files);
+    virtual void run() override;
+    // fileId -> lastModifiedMs(), 0 if the file is gone
+    Signal<std::function<void(Hash<uint32_t, uint64_t>)> > &finished() { return mFinished; }
+private:
+    const Hash<uint32_t, Path> mFiles;
+    Signal<std::function<void(Hash<uint32_t, uint64_t>)> > mFinished;
+};
+
+#endif
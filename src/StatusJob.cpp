@@ -33,7 +33,7 @@ int StatusJob::execute()
         return !strncasecmp(query.constData(), name, query.size());
     };
     bool matched = false;
-    const char *alternatives = "fileids|watchedpaths|dependencies|cursors|symbols|targets|symbolnames|sources|jobs|info|compilers|declarations|headererrors|memory";
+    const char *alternatives = "fileids|watchedpaths|dependencies|cursors|symbols|targets|symbolnames|sources|jobs|info|compilers|declarations|headererrors|memory|querycache";
 
     if (match("fileids")) {
         matched = true;
@@ -76,6 +76,12 @@ int StatusJob::execute()
             << "dataDir" << opt.dataDir << '\n'
             << "options" << opt.options
             << "jobCount" << opt.jobCount << '\n'
+            << "reservedJobCount" << opt.reservedJobCount << '\n'
+            << "minJobCount" << opt.minJobCount << '\n'
+            << "rpMemoryLimit" << opt.rpMemoryLimit << '\n'
+            << "indexCacheDir" << opt.indexCacheDir << '\n'
+            << "indexCacheSize" << opt.indexCacheSize << '\n'
+            << "rpBatchSize" << opt.rpBatchSize << '\n'
             << "rpVisitFileTimeout" << opt.rpVisitFileTimeout << '\n'
             << "rpIndexDataMessageTimeout" << opt.rpIndexDataMessageTimeout << '\n'
             << "rpConnectTimeout" << opt.rpConnectTimeout << '\n'
@@ -209,6 +215,7 @@ int StatusJob::execute()
         matched = true;
         if (!write(delimiter) || !write("jobs") || !write(delimiter))
             return 1;
+        flush();
         Server::instance()->dumpJobs(connection());
     }
 
@@ -248,6 +255,16 @@ int StatusJob::execute()
         matched = true;
     }
 
+    if (query.isEmpty() || match("querycache")) {
+        matched = true;
+        if (!write(delimiter) || !write("querycache") || !write(delimiter))
+            return 1;
+        const QueryCache &cache = proj->queryCache();
+        write<256>("  hits: %d misses: %d stale: %d entries: %d generation: %llu",
+                   cache.hits(), cache.misses(), cache.stale(), cache.size(),
+                   static_cast<unsigned long long>(cache.generation()));
+    }
+
 
     if (!matched) {
         write<256>("rc -s %s", alternatives);
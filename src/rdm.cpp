@@ -53,6 +53,9 @@ static void sigSegvHandler(int signal)
 #define DEFAULT_RP_CONNECT_ATTEMPTS 3
 #define DEFAULT_COMPLETION_CACHE_SIZE 10
 #define DEFAULT_MAX_CRASH_COUNT 5
+#define DEFAULT_RESERVED_JOB_COUNT 0
+#define DEFAULT_INDEX_CACHE_SIZE 1024
+#define DEFAULT_RP_BATCH_SIZE 1
 #define XSTR(s) #s
 #define STR(s) XSTR(s)
 static size_t defaultStackSize = 0;
@@ -92,6 +95,8 @@ static void usage(FILE *f)
 
          "  --job-count|-j [arg]                       Spawn this many concurrent processes for indexing (default %d).\n"
             "  --header-error-job-count|-H [arg]          Allow this many concurrent header error jobs (default std::max(1, --job-count / 2)).\n"
+            "  --min-job-count [arg]                      Let rdm lower the number of concurrent processes to this when memory or load is high and raise it back up to --job-count when there's headroom (default --job-count, i.e. fixed).\n"
+            "  --reserved-job-count [arg]                 Keep this many of the --job-count slots for interactive jobs (active buffers, unsaved files, waiting clients) (default " STR(DEFAULT_RESERVED_JOB_COUNT) ").\n"
             "  --log-file|-L [arg]                        Log to this file.\n"
 
 #ifndef OS_FreeBSD
@@ -103,6 +108,10 @@ static void usage(FILE *f)
             "  --rp-connect-attempts [arg]                Number of times rp attempts to connect to rdm before giving up. (default " STR(DEFAULT_RP_CONNECT_ATTEMPTS) ").\n"
             "  --rp-indexer-message-timeout|-T [arg]      Timeout for rp indexer-message in ms (0 means no timeout) (default " STR(DEFAULT_RP_INDEXER_MESSAGE_TIMEOUT) ").\n"
             "  --rp-nice-value|-a [arg]                   Nice value to use for rp (nice(2)) (default is no nicing).\n"
+            "  --index-cache [arg]                        Cache what rp produces in this directory, keyed on the arguments and file contents, and reuse it for translation units that haven't changed (default no cache).\n"
+            "  --index-cache-size [arg]                   Size in MB the index cache is kept below (default " STR(DEFAULT_INDEX_CACHE_SIZE) ").\n"
+            "  --rp-batch-size [arg]                      Let one rp index up to this many translation units from the same directory with the same include paths and defines when there are more of them pending than free slots (default " STR(DEFAULT_RP_BATCH_SIZE) ", one per rp).\n"
+            "  --rp-memory-limit [arg]                    Limit the address space of each rp to this many MB. An rp that runs out of memory is retried on its own without the limit (default 0, no limit).\n"
             "  --rp-visit-file-timeout|-Z [arg]           Timeout for rp visitfile commands in ms (0 means no timeout) (default " STR(DEFAULT_RP_VISITFILE_TIMEOUT) ").\n"
             "  --separate-debug-and-release|-E            Normally rdm doesn't consider release and debug as different builds. Pass this if you want it to.\n"
             "  --setenv|-e [arg]                          Set this environment variable (--setenv \"foobar=1\").\n"
@@ -134,6 +143,7 @@ static void usage(FILE *f)
             "  --Wlarge-by-value-copy|-r [arg]            Use -Wlarge-by-value-copy=[arg] when invoking clang.\n"
             "  --max-file-map-cache-size|-y [arg]         Max files to cache per query (Should not exceed maximum number of open file descriptors allowed per process) (default " STR(DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE) ").\n"
             "  --no-comments                              Don't parse/store doxygen comments.\n"
+            "  --indexer-callbacks                        Let rp collect symbols with clang_indexTranslationUnit's callbacks instead of visiting every cursor.\n"
             "  --arg-transform|-V [arg]                   Use arg to transform arguments. [arg] should be a executable with (execv(3)).\n"
             , std::max(2, ThreadPool::idealThreadCount()), defaultStackSize);
 }
@@ -227,6 +237,13 @@ int main(int argc, char** argv)
 #endif
         { "inactivity-timeout", required_argument, 0, '\5' },
         { "daemon", no_argument, 0, '\6' },
+        { "reserved-job-count", required_argument, 0, '\10' },
+        { "min-job-count", required_argument, 0, '\11' },
+        { "rp-memory-limit", required_argument, 0, '\12' },
+        { "index-cache", required_argument, 0, '\13' },
+        { "index-cache-size", required_argument, 0, '\14' },
+        { "rp-batch-size", required_argument, 0, '\15' },
+        { "indexer-callbacks", no_argument, 0, '\16' },
         { 0, 0, 0, 0 }
     };
     const String shortOptions = Rct::shortOptions(opts);
@@ -331,6 +348,10 @@ int main(int argc, char** argv)
     serverOpts.socketFile = String::format<128>("%s.rdm", Path::home().constData());
     serverOpts.jobCount = std::max(2, ThreadPool::idealThreadCount());
     serverOpts.headerErrorJobCount = -1;
+    serverOpts.reservedJobCount = DEFAULT_RESERVED_JOB_COUNT;
+    serverOpts.minJobCount = -1;
+    serverOpts.indexCacheSize = DEFAULT_INDEX_CACHE_SIZE;
+    serverOpts.rpBatchSize = DEFAULT_RP_BATCH_SIZE;
     serverOpts.rpVisitFileTimeout = DEFAULT_RP_VISITFILE_TIMEOUT;
     serverOpts.rpIndexDataMessageTimeout = DEFAULT_RP_INDEXER_MESSAGE_TIMEOUT;
     serverOpts.rpConnectTimeout = DEFAULT_RP_CONNECT_TIMEOUT;
@@ -620,6 +641,47 @@ int main(int argc, char** argv)
         case '\7':
             serverOpts.options |= Server::RPLogToSyslog;
             break;
+        case '\10':
+            serverOpts.reservedJobCount = atoi(optarg);
+            if (serverOpts.reservedJobCount < 0) {
+                fprintf(stderr, "Can't parse argument to --reserved-job-count %s. It must be a positive integer.\n", optarg);
+                return 1;
+            }
+            break;
+        case '\11':
+            serverOpts.minJobCount = atoi(optarg);
+            if (serverOpts.minJobCount <= 0) {
+                fprintf(stderr, "Can't parse argument to --min-job-count %s. It must be a positive integer.\n", optarg);
+                return 1;
+            }
+            break;
+        case '\12':
+            serverOpts.rpMemoryLimit = atoi(optarg);
+            if (serverOpts.rpMemoryLimit < 0) {
+                fprintf(stderr, "Can't parse argument to --rp-memory-limit %s. It must be a positive integer.\n", optarg);
+                return 1;
+            }
+            break;
+        case '\13':
+            serverOpts.indexCacheDir = Path::resolved(optarg).ensureTrailingSlash();
+            break;
+        case '\14':
+            serverOpts.indexCacheSize = atoi(optarg);
+            if (serverOpts.indexCacheSize <= 0) {
+                fprintf(stderr, "Can't parse argument to --index-cache-size %s. It must be a positive integer.\n", optarg);
+                return 1;
+            }
+            break;
+        case '\15':
+            serverOpts.rpBatchSize = atoi(optarg);
+            if (serverOpts.rpBatchSize <= 0) {
+                fprintf(stderr, "Can't parse argument to --rp-batch-size %s. It must be a positive integer.\n", optarg);
+                return 1;
+            }
+            break;
+        case '\16':
+            serverOpts.options |= Server::IndexerCallbacks;
+            break;
         case '?': {
             fprintf(stderr, "Run rdm --help for help\n");
             return 1; }
@@ -652,6 +714,12 @@ int main(int argc, char** argv)
         }
     }
 
+    if (serverOpts.minJobCount == -1) {
+        serverOpts.minJobCount = serverOpts.jobCount;
+    } else {
+        serverOpts.minJobCount = std::min(serverOpts.minJobCount, serverOpts.jobCount);
+    }
+
     if (serverOpts.headerErrorJobCount == -1) {
         serverOpts.headerErrorJobCount = std::max(1, serverOpts.jobCount / 2);
     } else {
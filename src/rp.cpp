@@ -13,7 +13,6 @@
    You should have received a copy of the GNU General Public License
    along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 
-#define RTAGS_SINGLE_THREAD
 #include "ClangIndexer.h"
 #include "RTagsClang.h"
 #include "Source.h"
@@ -21,12 +20,49 @@
 #include <rct/Log.h>
 #include <rct/StopWatch.h>
 #include <rct/String.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
 #include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <syslog.h>
+#include <unistd.h>
 #include "Server.h"
 
+static rlim_t sMemoryLimit = 0; // bytes, 0 means no limit
+
+// True if the address space got within 10% of --memory-limit. libclang
+// aborts, or crashes on a null pointer, when an allocation fails instead of
+// going through the new handler.
+static bool nearMemoryLimit()
+{
+    if (!sMemoryLimit)
+        return false;
+    const int fd = open("/proc/self/status", O_RDONLY);
+    if (fd == -1)
+        return false;
+    char buf[8192];
+    const ssize_t r = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (r <= 0)
+        return false;
+    buf[r] = '\0';
+    const char *peak = strstr(buf, "VmPeak:");
+    unsigned long long kb;
+    if (!peak || sscanf(peak + 7, "%llu", &kb) != 1)
+        return false;
+    return static_cast<rlim_t>(kb) * 1024 >= sMemoryLimit / 10 * 9;
+}
+
 static void sigHandler(int signal)
 {
+    if ((signal == SIGABRT || signal == SIGSEGV) && nearMemoryLimit()) {
+        static const char msg[] = "rp: out of memory\n";
+        if (write(STDERR_FILENO, msg, sizeof(msg) - 1)) {}
+        _exit(RTags::OutOfMemoryExitCode);
+    }
     // this is not really allowed in signal handlers but will mostly work
     const String trace = Rct::backtrace();
     if (ClangIndexer::serverOpts() & Server::SuspendRPOnCrash) {
@@ -54,6 +90,13 @@ Set<Symbol> findTargets(const std::shared_ptr<Project> &, const Symbol &) { retu
 Set<Symbol> findCallers(const std::shared_ptr<Project> &, const Symbol &) { return Set<Symbol>(); }
 String findSymbolNameByUsr(const std::shared_ptr<Project> &, uint32_t, const String &) { return String(); }
 
+static void outOfMemoryHandler()
+{
+    static const char msg[] = "rp: out of memory\n";
+    if (write(STDERR_FILENO, msg, sizeof(msg) - 1)) {}
+    _exit(RTags::OutOfMemoryExitCode);
+}
+
 struct SyslogCloser
 {
 public:
@@ -67,9 +110,12 @@ int main(int argc, char **argv)
 {
     LogLevel logLevel = LogLevel::Error;
     Path file;
+    int memoryLimit = 0; // MB
     for (int i=1; i<argc; ++i) {
         if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
             ++logLevel;
+        } else if (!strcmp(argv[i], "--memory-limit") && i + 1 < argc) {
+            memoryLimit = atoi(argv[++i]);
         } else {
             file = argv[i];
         }
@@ -80,6 +126,17 @@ int main(int argc, char **argv)
     signal(SIGABRT, sigHandler);
     signal(SIGBUS, sigHandler);
 
+    std::set_new_handler(outOfMemoryHandler);
+    if (memoryLimit > 0) {
+        struct rlimit limit;
+        limit.rlim_cur = limit.rlim_max = static_cast<rlim_t>(memoryLimit) * 1024 * 1024;
+        if (setrlimit(RLIMIT_AS, &limit)) {
+            fprintf(stderr, "Failed to set memory limit of %dMB: %s\n", memoryLimit, strerror(errno));
+        } else {
+            sMemoryLimit = limit.rlim_cur;
+        }
+    }
+
     Flags<LogMode> logType = LogStderr;
     std::shared_ptr<SyslogCloser> closer;
     if (ClangIndexer::serverOpts() & Server::RPLogToSyslog) {
@@ -92,16 +149,30 @@ int main(int argc, char **argv)
     RTags::initMessages();
     std::shared_ptr<EventLoop> eventLoop(new EventLoop);
     eventLoop->init(EventLoop::MainEventLoop);
-    String data;
-
+    // the jobs of a batch share the index
+    std::shared_ptr<void> index(clang_createIndex(0, 1), clang_disposeIndex);
     if (!file.isEmpty()) {
-        data = file.readAll();
-    } else {
+        ClangIndexer indexer(index.get());
+        if (!indexer.exec(file.readAll())) {
+            error() << "ClangIndexer error";
+            return 3;
+        }
+        return 0;
+    }
+
+    // rdm sends one or more jobs, each prefixed by its size, followed by a 0
+    int jobs = 0;
+    while (true) {
         uint32_t size;
         if (!fread(&size, sizeof(size), 1, stdin)) {
+            if (jobs)
+                break;
             error() << "Failed to read from stdin";
             return 1;
         }
+        if (!size)
+            break;
+        String data;
         data.resize(size);
         if (!fread(&data[0], size, 1, stdin)) {
             error() << "Failed to read from stdin";
@@ -110,11 +181,12 @@ int main(int argc, char **argv)
         // FILE *f = fopen("/tmp/data", "w");
         // fwrite(data.constData(), data.size(), 1, f);
         // fclose(f);
-    }
-    ClangIndexer indexer;
-    if (!indexer.exec(data)) {
-        error() << "ClangIndexer error";
-        return 3;
+        ClangIndexer indexer(index.get());
+        if (!indexer.exec(data)) {
+            error() << "ClangIndexer error";
+            return 3;
+        }
+        ++jobs;
     }
 
     return 0;
@@ -1491,6 +1491,7 @@ is true. References to references will be treated as references to the reference
 
 (defvar rtags-last-index nil)
 (defvar rtags-last-total nil)
+(defvar rtags-last-eta nil)
 
 (defun rtags-modeline-format-helper (type count)
   (and (> count 0)
@@ -1502,7 +1503,10 @@ is true. References to references will be treated as references to the reference
                rtags-last-total
                (> rtags-last-total rtags-last-index)
                (> rtags-last-total 0)
-               (format "%d/%d %d%%%%" rtags-last-index rtags-last-total (/ (* rtags-last-index 100) rtags-last-total))))
+               (concat (format "%d/%d %d%%%%" rtags-last-index rtags-last-total (/ (* rtags-last-index 100) rtags-last-total))
+                       (if (and rtags-last-eta (> rtags-last-eta 0))
+                           (format " ETA %d:%02d" (/ rtags-last-eta 60) (% rtags-last-eta 60))
+                         ""))))
          (errors (if rtags-error-warning-count
                      (car rtags-error-warning-count)
                    0))
@@ -1619,8 +1623,9 @@ is true. References to references will be treated as references to the reference
                 ((eq (car data) 'checkstyle)
                  (rtags-parse-check-style (cdr data)))
                 ((eq (car data) 'progress)
-                 (setq rtags-last-index (nth 2 data)
-                       rtags-last-total (nth 3 data)))
+                 (setq rtags-last-index (nth 1 data)
+                       rtags-last-total (nth 2 data)
+                       rtags-last-eta (nth 3 data)))
                 ((eq (car data) 'completions)
                  (setq rtags-last-completions (cadr data)))
                 (t))
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# Indexes the sources under tests/ with both of rp's indexing engines, the
+# cursor visitor and --indexer-callbacks, and prints how long each took and
+# how the symbols, targets, usrs and symbol names they found differ. Exits
+# with 1 if a source wasn't compared or the engines didn't agree on it.
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+TMP=`mktemp -d`
+SOCKET="$TMP/rdm.socket"
+
+RTAGS_COMPARE_INDEXERS=1 rdm --no-rc --silent --data-dir "$TMP/data" --socket-file "$SOCKET" \
+    --log-file "$TMP/rdm.log" --job-count 1 "$@" &
+sleep 2
+
+SOURCES=`find "$DIR" \( -name "*.cpp" -o -name "*.c" -o -name "*.m" \) | sort`
+echo "$SOURCES" | while read file; do
+    case "$file" in
+        *.c) compiler=clang ;;
+        *.m) compiler="clang -x objective-c" ;;
+        *) compiler="clang++ -std=c++11" ;;
+    esac
+    rc --socket-file "$SOCKET" --compile "$compiler -I`dirname $file` -c $file" --project-root `dirname $file`
+done
+
+sleep 1
+while [ "`rc --socket-file "$SOCKET" --is-indexing`" = "1" ]; do
+    sleep 1
+done
+
+rc --socket-file "$SOCKET" --quit-rdm
+wait
+grep -A20 "Indexer comparison" "$TMP/rdm.log" | grep -v "^--$" | grep "^Indexer comparison\|^  /"
+
+RESULT=0
+for file in $SOURCES; do
+    line=`grep "Indexer comparison for $file " "$TMP/rdm.log" | tail -1`
+    if [ -z "$line" ]; then
+        echo "FAIL: $file wasn't compared"
+        RESULT=1
+    elif [ "${line% identical}" = "$line" ]; then
+        echo "FAIL: $file"
+        RESULT=1
+    fi
+done
+[ "$RESULT" = "0" ] && echo "PASS: `echo "$SOURCES" | wc -l` sources indexed identically"
+rm -rf "$TMP"
+exit $RESULT